@@ -40,6 +40,28 @@ static std::string write_info(radar::Imagery &imagery) {
         }
     }
 
+    if (imagery.missing_radars.size() != 0) {
+        std::string missing = "\nMissing (too slow or failed):";
+        for (auto &kode : imagery.missing_radars) {
+            missing += " " + kode;
+        }
+
+        if (output.size() + missing.size() <= 2000) {
+            output += missing;
+        }
+    }
+
+    if (imagery.skipped_radars.size() != 0) {
+        std::string skipped = "\nSkipped (not responding lately):";
+        for (auto &kode : imagery.skipped_radars) {
+            skipped += " " + kode;
+        }
+
+        if (output.size() + skipped.size() <= 2000) {
+            output += skipped;
+        }
+    }
+
     return output;
 }
 
@@ -68,8 +90,12 @@ void run(dpp::cluster &bot, const dpp::slashcommand_t &event) {
         }
 
         map::Tiles tiles(bounding[0], bounding[1], bounding[2], bounding[3]);
+        // nobody waits longer than this on discord anyway
+        tiles.deadline = std::make_shared<fetch::Deadline>(std::chrono::seconds(60));
         radar::Imagery imagery;
         imagery.ignore_old_radars = ignore_old;
+        // a map with a radar or two missing beats an error after 20 seconds
+        imagery.latency_budget = std::chrono::seconds(3);
 
         cv::Mat image;
 
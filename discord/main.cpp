@@ -2,6 +2,11 @@
 #include "command_manager.hpp"
 #include "commands/render.hpp"
 #include <dpp/dpp.h>
+#include <radarworker/catalog.hpp>
+#include <radarworker/fetch.hpp>
+#include <radarworker/frames.hpp>
+#include <radarworker/ownership.hpp>
+#include <radarworker/prefetch.hpp>
 
 void loader() {
     commands::render::init();
@@ -54,6 +59,20 @@ int main() {
     bot.on_ready([&bot](const dpp::ready_t &event) {
         if (dpp::run_once<struct reg_commands>()) {
             register_commands(bot);
+            // background failures go where the stats do
+            radar::set_error_log([&bot](const std::string &message) { bot.log(dpp::ll_warning, message); });
+            // renders only composite frames that are already decoded
+            radar::Prefetcher::global().start();
+
+            // tells a slow BMKG apart from a slow network or a slow TLS handshake
+            bot.start_timer(
+                [&bot](dpp::timer) {
+                    std::string report = fetch::stats().report() + radar::FrameCache::global().stats().report() +
+                                         radar::OwnershipCache::global().stats().report();
+                    report.pop_back();
+                    bot.log(dpp::ll_info, report);
+                },
+                300);
         }
     });
     bot.on_slashcommand([&bot](const dpp::slashcommand_t &event) {
@@ -69,6 +88,8 @@ int main() {
     });
 
     bot.start(dpp::st_wait);
+    // the catalog and the prefetcher outlive the bot
+    radar::set_error_log(nullptr);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <radarworker/fetch.hpp>
+#include <radarworker/radar.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace radar {
+// every radar BMKG has along with its latest detail, one per process. refreshed in the
+// background around when BMKG publishes new frames, so a render doesn't have to make
+// a single metadata request of its own. every refresh is also stored, see FrameStore
+class RadarCatalog {
+  public:
+    // never changes once published, a render can hold on to it for as long as it needs. a
+    // refresh or an update publishes a new one instead
+    struct Snapshot {
+        std::vector<RadarList> list;
+        // over list, for picking the radars of a viewport
+        std::shared_ptr<const RadarIndex> index;
+        // by radar code, radars without any data right now are left out. shared with the
+        // snapshots before and after this one, and with every render that picked them
+        std::map<std::string, std::shared_ptr<const RadarImage>> details;
+        // by radar code, why its detail couldn't be refreshed. the previous one is kept if there was any
+        std::map<std::string, std::string> errors;
+        std::chrono::system_clock::time_point refreshed;
+    };
+
+    // in between these, refreshes follow BMKG's frame interval
+    std::chrono::seconds min_refresh_interval{30};
+    std::chrono::seconds max_refresh_interval{600};
+    // how long a background refresh may take
+    std::chrono::seconds refresh_timeout{60};
+
+    static RadarCatalog &global();
+    ~RadarCatalog();
+
+    // the latest snapshot. the very first call starts the background refresh and waits for its first
+    // snapshot within deadline, throwing if it doesn't make it. the refresh itself carries on regardless
+    std::shared_ptr<const Snapshot> snapshot(std::shared_ptr<fetch::Deadline> deadline = nullptr);
+    // fetches a new snapshot right away and publishes it
+    std::shared_ptr<const Snapshot> refresh(std::shared_ptr<fetch::Deadline> deadline = nullptr);
+    // a newer detail of one radar, e.g. from the Prefetcher, published as a new snapshot
+    void update(const RadarImage &detail);
+
+  private:
+    RadarCatalog() {}
+    void refresh_loop();
+    // the snapshot the last run stored, if it's recent enough to serve while a fresh one comes in
+    std::shared_ptr<const Snapshot> load_stored();
+    std::chrono::seconds next_refresh_in(const Snapshot &snapshot);
+
+    // only ever swapped whole with std::atomic_load/std::atomic_store, renders only wait on the first refresh
+    std::shared_ptr<const Snapshot> current;
+    // the background refresh in progress, cancelled on shutdown
+    std::shared_ptr<fetch::Deadline> refreshing;
+    // a render is waiting for the first snapshot, don't wait out the interval
+    bool refresh_now = false;
+    // so the renders waiting for the first snapshot can give up once the refresh they waited on failed
+    unsigned long failed_refreshes = 0;
+    std::string refresh_error;
+    bool stopping = false;
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    // every time a refresh is over, one way or the other
+    std::condition_variable published;
+    std::thread refresher;
+};
+
+// where the background refresh and the prefetcher report what went wrong, since nobody's waiting
+// on them to throw at. a line each, to stdout unless set, e.g. to the bot's log
+void set_error_log(std::function<void(const std::string &message)> error_log);
+void log_error(const std::string &message);
+
+std::string detailed_data_url(const std::string &code);
+// both stream through the response and keep only the fields they need, no JSON tree is built
+std::vector<RadarList> parse_radar_list(const fetch::Buffer &content);
+// false if the radar has no data right now
+bool parse_radar_detail(const fetch::Buffer &content, RadarImage &radar_data);
+// BMKG's "2024-05-01 13:40 UTC", without going through a stream
+std::chrono::system_clock::time_point parse_utc_time(const std::string &text);
+} // namespace radar
+
+#endif
@@ -1,5 +1,313 @@
+#ifndef FETCH_HPP
+#define FETCH_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <curl/curl.h>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 namespace fetch {
+struct HostLimit {
+    // token bucket, requests per second and how many can go out at once. 0 rate means unlimited
+    double rate = 0;
+    double burst = 1;
+    // running transfers to this host, 0 means unlimited
+    long max_in_flight = 0;
+};
+
+struct Config {
+    // simultaneous connections to a single host, 0 means unlimited
+    long max_host_connections = 8;
+    // idle connections kept alive in the cache for reuse
+    long max_connections = 32;
+    // HTTP/2 streams multiplexed over a single connection
+    long max_concurrent_streams = 100;
+    // CURL_HTTP_VERSION_2TLS negotiates HTTP/2 over TLS and falls back to HTTP/1.1,
+    // CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE is needed for cleartext HTTP/2 servers
+    long http_version = CURL_HTTP_VERSION_2TLS;
+    // encodings offered to servers, decoded transparently before the body reaches anyone.
+    // empty offers everything curl was built with (gzip, deflate, br, zstd)
+    std::string accept_encoding;
+    // by host name, anything not listed here uses default_host_limit
+    std::map<std::string, HostLimit> host_limits = {
+        // https://operations.osmfoundation.org/policies/nominatim/
+        {"nominatim.openstreetmap.org", {1, 1, 1}},
+        {"tile.openstreetmap.org", {50, 100, 16}},
+        {"radar.bmkg.go.id", {20, 40, 8}},
+        {"api-apps.bmkg.go.id", {20, 40, 8}},
+    };
+    HostLimit default_host_limit;
+    // finished requests a host needs before its p95 latency is trusted for hedging
+    unsigned long hedge_min_samples = 20;
+    // hedges as a fraction of all requests, so a host that's slow because it's overloaded
+    // doesn't end up with twice the load
+    double hedge_budget = 0.1;
+};
+
+// shared by every transfer of one render, once it expires or gets cancelled
+// all of its outstanding transfers are aborted at once
+class Deadline {
+  public:
+    // no time limit, can still be cancelled
+    Deadline() : at(std::chrono::steady_clock::time_point::max()) {}
+    Deadline(std::chrono::milliseconds budget) : at(std::chrono::steady_clock::now() + budget) {}
+    // a shorter budget within parent, which still cancels or expires this one along with it
+    Deadline(std::chrono::milliseconds budget, std::shared_ptr<Deadline> parent)
+        : at(parent ? std::min(std::chrono::steady_clock::now() + budget, parent->at)
+                    : std::chrono::steady_clock::now() + budget),
+          parent(std::move(parent)) {}
+
+    void cancel() { cancelled = true; }
+    bool is_cancelled() const { return cancelled || (parent && parent->is_cancelled()); }
+    bool expired() const { return is_cancelled() || std::chrono::steady_clock::now() >= at; }
+    // 0 once expired, LONG_MAX when there's no limit
+    long remaining_ms() const;
+
+    const std::chrono::steady_clock::time_point at;
+
+  private:
+    std::shared_ptr<Deadline> parent;
+    std::atomic<bool> cancelled{false};
+};
+
+// identical requests in flight at the same time share one transfer, see Client. it goes out with the
+// highest priority, the most retries and the longest timeouts any of them asked for, and is hedged if
+// any of them wants it. each keeps its own deadline, the transfer carries on until the last one is
+// gone. site and caller stay the first one's
+struct Options {
+    Options() {}
+    Options(std::list<std::string> headers) : headers(std::move(headers)) {}
+
+    std::list<std::string> headers;
+    // all in milliseconds, 0 means no limit
+    long connect_timeout_ms = 10000;
+    long timeout_ms = 20000;
+    // abort when the transfer is slower than low_speed_limit bytes/s for low_speed_time seconds
+    long low_speed_limit = 1024;
+    long low_speed_time = 10;
+    std::shared_ptr<Deadline> deadline;
+    // requests waiting on the same host go out highest priority first, then in submission order
+    int priority = 0;
+    // who's waiting on this, e.g. one render. within a priority, callers take turns at a host, so one
+    // big batch can't hold everyone else's requests up until it's done. get_many gives every batch
+    // its own unless set, single requests without one share a turn
+    std::string caller;
+    // wait for a connection to the same host that can multiplex this request over HTTP/2,
+    // rather than opening a new one. meant for batches, like the map tiles of one render
+    bool multiplex = false;
+    // extra attempts after a connection error, a timeout or a 5xx/429 answer.
+    // every request this client makes is a GET, so they're all safe to repeat. off unless asked
+    // for, a dead host would otherwise hold every caller up for (retries + 1) * timeout_ms
+    int retries = 0;
+    // the first retry waits around this long, doubling every attempt, give or take half of it
+    long retry_backoff_ms = 250;
+    // once a transfer runs longer than the host's p95 latency, send the same request
+    // again and take whichever answers first
+    bool hedge = false;
+    // a 4xx answer fails the request too, instead of handing its error page over as the body.
+    // for callers that keep what they get, like the radar frames
+    bool fail_on_error = false;
+    // who's asking, e.g. radar_image or tile. timings are broken down by it, empty counts as other
+    std::string site;
+};
+
+// distribution of positive values (ms, bytes) in log-spaced buckets, from 1 up to about 10^8
+class Histogram {
+  public:
+    void record(double ms);
+    // upper bound of the bucket the p quantile falls in, 0 without samples
+    double percentile(double p) const;
+    double mean() const { return samples != 0 ? sum / samples : 0; }
+    unsigned long count() const { return samples; }
+
+  private:
+    std::array<unsigned long, 48> buckets = {};
+    unsigned long samples = 0;
+    double sum = 0;
+};
+
+// curl's timing breakdown of finished requests, in ms, each phase on its own
+struct Timings {
+    // only requests that had to open a connection
+    Histogram dns;
+    Histogram connect;
+    Histogram tls;
+    // request sent to first byte back, mostly time spent on the server
+    Histogram server;
+    // first byte to last
+    Histogram transfer;
+    Histogram total;
+    // body size as downloaded, before any decoding
+    Histogram bytes;
+    // decoded minus downloaded, what compression saved
+    unsigned long long bytes_saved = 0;
+};
+
+struct Stats {
+    unsigned long requests = 0;
+    // connections that had to be opened, including their DNS lookup
+    unsigned long connections_opened = 0;
+    // requests that went out over a connection already open, no DNS lookup, connect or TLS handshake.
+    // TLS sessions resumed on new connections aren't told apart, those count as opened
+    unsigned long connections_reused = 0;
+    // requests that joined an identical transfer already in flight instead of starting their own
+    unsigned long coalesced = 0;
+    // attempts repeated after a failure, duplicates sent for slow transfers and how often those won
+    unsigned long retries = 0;
+    unsigned long hedges = 0;
+    unsigned long hedges_won = 0;
+    // response bodies as they came over the wire, and how many more bytes they'd have been uncompressed
+    unsigned long long bytes_downloaded = 0;
+    unsigned long long bytes_saved = 0;
+    // successful requests by host
+    std::map<std::string, Histogram> latency;
+    std::map<std::string, Timings> timings_by_host;
+    std::map<std::string, Timings> timings_by_site;
+
+    // one line of counters, then one line per host and per site, for the log
+    std::string report() const;
+};
+
+// ref-counted, read-only response body. the transfer fills it in place and every
+// copy after that shares the same bytes, all the way into the image decoder
+class Buffer {
+  public:
+    Buffer() {}
+    Buffer(std::shared_ptr<const std::vector<unsigned char>> bytes) : bytes(std::move(bytes)) {}
+
+    const unsigned char *data() const { return bytes ? bytes->data() : nullptr; }
+    size_t size() const { return bytes ? bytes->size() : 0; }
+    bool empty() const { return size() == 0; }
+    // makes a copy, only for callers that really need a string
+    std::string str() const { return std::string(reinterpret_cast<const char *>(data()), size()); }
+
+  private:
+    std::shared_ptr<const std::vector<unsigned char>> bytes;
+};
+
+// called from the I/O thread once a transfer is over, error is null on success.
+// keep it short, every other transfer waits for it to return
+typedef std::function<void(const std::string &url, Buffer body, std::exception_ptr error)> Callback;
+
+// moves the bytes behind the fetch:: functions below, so the render pipeline can run against
+// recorded responses instead of BMKG and OSM. see transport.hpp for the offline ones
+class Transport {
+  public:
+    virtual ~Transport() {}
+
+    // on_complete is called exactly once, from whatever thread the transport finishes on
+    virtual void submit(const std::string &url, const Options &options, Callback on_complete) = 0;
+    virtual Stats stats() = 0;
+};
+
+// long-lived HTTP client, every transfer is driven by a single I/O thread
+// through one curl multi handle, so connections are kept alive and reused.
+// concurrent requests for the same url and headers share a single transfer.
+// each host is rate limited and capped on running transfers, see Config::host_limits.
+// failed transfers are retried with backoff and slow ones can be hedged, see Options
+class Client : public Transport {
+  public:
+    Client(Config config = Config());
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    // the client used by fetch::get
+    static Client &global();
+
+    void configure(Config config);
+    void submit(const std::string &url, const Options &options, Callback on_complete) override;
+    std::future<Buffer> get_async(const std::string &url, const Options &options = Options());
+    Buffer get(const std::string &url, const Options &options = Options());
+    Stats stats() override;
+
+  private:
+    struct Transfer;
+    struct Attempt;
+
+    struct HostQueue {
+        // ordered by -priority, then turn, then submission order
+        std::map<std::tuple<int, unsigned long, unsigned long>, Transfer *> pending;
+        // by priority, the turn of the last transfer that went out, and each caller's next turn
+        std::map<int, unsigned long> turn;
+        std::map<std::pair<int, std::string>, unsigned long> next_turn;
+        long in_flight = 0;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point refilled;
+    };
+
+    void io_loop();
+    void apply_config();
+    HostLimit limit_of(const std::string &host);
+    void refill(HostQueue &host, const HostLimit &limit);
+    long admit();
+    void hedge();
+    bool start(Transfer *transfer, bool is_hedge = false);
+    void finish(CURL *handle, CURLcode result);
+    bool retry(Transfer *transfer);
+    void release(Attempt *attempt);
+    void expire_waiters();
+    long poll_timeout_ms();
+    void complete(Transfer *transfer, Buffer body, std::exception_ptr error);
+    void merge(Transfer *transfer, const Options &options);
+
+    CURLM *multi;
+    Config config;
+    Stats counters;
+    bool config_dirty = true;
+    bool stopping = false;
+    std::mutex mtx;
+    std::deque<Transfer *> queue;
+    // options of requests that joined a transfer in flight, by its request key, for the I/O thread to merge in
+    std::vector<std::pair<std::string, Options>> joined;
+    // queued or running transfers by request key
+    std::map<std::string, Transfer *> inflight;
+    unsigned long submitted = 0;
+    // only touched by the I/O thread
+    std::set<Attempt *> active;
+    std::map<std::string, HostQueue> hosts;
+    // failed transfers waiting out their backoff, by when they can go again
+    std::multimap<std::chrono::steady_clock::time_point, Transfer *> backoff;
+    std::thread io_thread;
+};
+
+// lower-cased host name of the url
+std::string host_of(const std::string &url);
+// identical requests share a transfer, headers included since they can change the response
+std::string request_key(const std::string &url, const Options &options);
+std::future<Buffer> submit_async(Transport &transport, const std::string &url, const Options &options);
+
+// used by the functions below. defaults to Client::global(), unless the fetch_record or
+// fetch_replay environment variable points at a fixture directory, see transport.hpp
+std::shared_ptr<Transport> transport();
+void set_transport(std::shared_ptr<Transport> transport);
+
+// applies to Client::global()
+void configure(Config config);
 std::string get(std::string url, std::list<std::string> headers = {});
-}
\ No newline at end of file
+std::string get(std::string url, Options options);
+std::future<Buffer> get_async(std::string url, Options options = Options());
+// one future per url, in the same order. a failed url only throws from its own future
+std::vector<std::future<Buffer>> get_many(const std::vector<std::string> &urls, Options options = Options());
+// on_complete is called once per url, in completion order
+void get_many(const std::vector<std::string> &urls, Options options, Callback on_complete);
+Stats stats();
+} // namespace fetch
+
+#endif
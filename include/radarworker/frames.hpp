@@ -0,0 +1,63 @@
+#ifndef FRAMES_HPP
+#define FRAMES_HPP
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <radarworker/fetch.hpp>
+#include <string>
+#include <utility>
+
+namespace radar {
+// a downloaded or stored frame, empty if it isn't an image, e.g. an error page that came back instead
+cv::Mat decode_frame(const fetch::Buffer &content);
+
+// decoded radar frames by station and frame time, filled by the Prefetcher and by every
+// render that had to decode one itself. a published frame never changes, so an entry is
+// good for as long as it's kept. frames are shared, never write into one you got from here
+class FrameCache {
+  public:
+    struct Stats {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long evictions = 0;
+        unsigned long long bytes = 0;
+        unsigned long frames = 0;
+
+        // one line, for the log
+        std::string report() const;
+    };
+
+    // least recently used frames are evicted past this
+    size_t max_bytes = 256 * 1024 * 1024;
+
+    static FrameCache &global();
+
+    // empty if it isn't here
+    cv::Mat get(const std::string &code, std::chrono::system_clock::time_point time);
+    void put(const std::string &code, std::chrono::system_clock::time_point time, cv::Mat frame);
+    Stats stats();
+
+  private:
+    typedef std::pair<std::string, std::chrono::system_clock::time_point> Key;
+
+    struct Frame {
+        Key key;
+        cv::Mat image;
+        size_t bytes;
+    };
+
+    // called with mtx held
+    void evict();
+
+    // most recently used first
+    std::list<Frame> frames;
+    std::map<Key, std::list<Frame>::iterator> index;
+    Stats counters;
+    std::mutex mtx;
+};
+} // namespace radar
+
+#endif
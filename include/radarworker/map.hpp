@@ -4,7 +4,10 @@
 #include <array>
 #include <boost/filesystem.hpp>
 #include <future>
+#include <list>
+#include <memory>
 #include <opencv2/opencv.hpp>
+#include <radarworker/fetch.hpp>
 #include <radarworker/radar.hpp>
 #include <string>
 #include <vector>
@@ -21,15 +24,20 @@ class Tiles {
     }
     int zoom_level;
     cv::Mat render();
-    void download_each(std::vector<std::string> *tiles_images, int tiles_x, int tiles_y, boost::filesystem::path usr_tempdir,
-        int pos, std::mutex &mtx, std::string &runtime_error);
     cv::Mat render_with_overlay_radar(float map_brightness = 0.7f, float radar_opacity = 0.6f);
     cv::Mat render_with_overlay_radar(radar::Imagery &imagery, float map_brightness = 0.7f, float radar_opacity = 0.6f);
     int MAX_APPROPRIATE_TILES = 50;
+    // shared with the radar imagery when rendering with overlay, unless it has its own
+    std::shared_ptr<fetch::Deadline> deadline;
     void set_appropriate_zoom_level();
 
   private:
     std::array<double, 4> boundaries = {0.0, 0.0, 0.0, 0.0};
+    std::string tile_url(int tiles_x, int tiles_y);
+    std::list<std::string> tile_headers();
+    // returns false if the tile isn't on disk yet
+    bool read_cached_tile(const std::string &url, const boost::filesystem::path &usr_tempdir, fetch::Buffer &data);
+    void write_cached_tile(const std::string &url, const boost::filesystem::path &usr_tempdir, const fetch::Buffer &data);
     // returns {n, w, s, e}
     std::array<double, 4> get_tiles_range();
     // returns {x, y}
@@ -0,0 +1,90 @@
+#ifndef OWNERSHIP_HPP
+#define OWNERSHIP_HPP
+
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace radar {
+// where a radar is, how far it reaches and how much it's preferred over the radars around it
+struct PositionalData {
+    double lon;
+    double lat;
+    double range;
+    int priority;
+    // set by rivals_of, whether current has to check where this one's circle crosses a row
+    bool use_Qx2;
+};
+
+// the pixels of a map one radar gets to draw, as [start, end) column spans per row
+struct Ownership {
+    // height + 1 of them, the spans of row y are spans[row_offsets[y]] up to spans[row_offsets[y + 1]]
+    std::vector<int> row_offsets;
+    // start, end, start, end...
+    std::vector<int> spans;
+};
+
+// ownership only depends on the map's bounds and size and on the position, range and priority of
+// a radar and of its neighbours, not on the frame. so a new frame of the same area reuses it, and
+// so does every other render of the same area. least recently used first out past max_bytes
+class OwnershipCache {
+  public:
+    struct Stats {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long evictions = 0;
+        unsigned long long bytes = 0;
+        unsigned long entries = 0;
+
+        // one line, for the log
+        std::string report() const;
+    };
+
+    size_t max_bytes = 16 * 1024 * 1024;
+
+    static OwnershipCache &global();
+
+    // nullptr if it isn't here
+    std::shared_ptr<const Ownership> get(const std::vector<double> &key);
+    void put(const std::vector<double> &key, std::shared_ptr<const Ownership> ownership);
+    Stats stats();
+
+  private:
+    struct Entry {
+        std::vector<double> key;
+        std::shared_ptr<const Ownership> ownership;
+        size_t bytes;
+    };
+
+    // called with mtx held
+    void evict();
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::map<std::vector<double>, std::list<Entry>::iterator> index;
+    Stats counters;
+    std::mutex mtx;
+};
+
+// of neighbours, the ones that can take pixels from current: overlapping it and not of a lower priority
+std::vector<PositionalData> rivals_of(const PositionalData &current, const std::vector<PositionalData> &neighbours);
+// current's pixels of a width x height map, by solving where its border with every rival crosses
+// each row. one radar at a time, see label_coverage for all of them at once
+std::shared_ptr<const Ownership> solve_ownership(const std::array<double, 4> &boundaries, int width, int height,
+    const PositionalData &current, const std::vector<PositionalData> &rivals);
+
+// which of radars draws each pixel of a width x height map, row by row from the top, -1 for none.
+// a pixel goes to the highest priority radar covering it, the closest one of those on a tie, which
+// is what solving every radar's border comes down to. every row is done once, for all radars at once
+std::vector<int> label_coverage(
+    const std::array<double, 4> &boundaries, int width, int height, const std::vector<PositionalData> &radars);
+// the spans of every one of count radars in a label map
+std::vector<std::shared_ptr<const Ownership>> ownership_of_labels(
+    const std::vector<int> &labels, int width, int height, int count);
+} // namespace radar
+
+#endif
@@ -2,10 +2,12 @@
 #define PNG_HPP
 
 #include <array>
+#include <cstddef>
 #include <string>
 
 namespace png {
 std::array<unsigned int, 2> get_resolution(std::string& data);
+std::array<unsigned int, 2> get_resolution(const unsigned char *data, size_t size);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef PREFETCH_HPP
+#define PREFETCH_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <radarworker/radar.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace radar {
+// downloads and decodes every station's new frame right after BMKG publishes it, so
+// renders only have to composite frames that are already in the FrameCache. each
+// station's publication interval is learned from its LastOneHour history
+class Prefetcher {
+  public:
+    // BMKG takes a little while to put a frame up after its timestamp
+    std::chrono::seconds publish_delay{30};
+    // look again after this when an expected frame isn't up yet
+    std::chrono::seconds retry_interval{30};
+    // until a station has a history to learn from
+    std::chrono::seconds default_interval{300};
+    // per round of polls, frame downloads included
+    std::chrono::seconds poll_timeout{30};
+
+    static Prefetcher &global();
+    ~Prefetcher();
+
+    void start();
+    void stop();
+
+  private:
+    Prefetcher() {}
+
+    struct Station {
+        std::chrono::seconds interval{0};
+        std::chrono::system_clock::time_point latest;
+        std::chrono::system_clock::time_point next_poll;
+    };
+
+    void run();
+    void poll(const std::vector<std::string> &codes, std::shared_ptr<fetch::Deadline> deadline);
+    void warm(const std::vector<RadarImage> &radars, std::shared_ptr<fetch::Deadline> deadline);
+    void schedule(Station &station, const RadarImage &detail, bool is_new);
+
+    std::map<std::string, Station> stations;
+    bool stopping = false;
+    std::shared_ptr<fetch::Deadline> polling;
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    std::thread worker;
+};
+
+// median gap between a station's frames, 0 if it doesn't have two of them
+std::chrono::seconds publication_interval(const RadarImage &detail);
+} // namespace radar
+
+#endif
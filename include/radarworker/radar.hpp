@@ -6,7 +6,13 @@
 
 #include <array>
 #include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <radarworker/fetch.hpp>
+#include <radarworker/ownership.hpp>
+#include <radarworker/spatial.hpp>
 #include <string>
 #include <vector>
 
@@ -65,6 +71,36 @@ struct RadarImage {
     std::vector<Color> colors;
 };
 
+// stops renders from waiting on a radar (or a whole host) that keeps failing. after
+// failure_threshold failures in a row it opens and everything for that key is skipped,
+// once cool_down is over a single render gets through as the probe and closes it again
+// if that works. shared by every Imagery in the process
+class CircuitBreaker {
+  public:
+    int failure_threshold = 3;
+    std::chrono::seconds cool_down{60};
+
+    static CircuitBreaker &global();
+
+    // false means skip it. while half open, only the probe gets true
+    bool allow(const std::string &key);
+    void record_success(const std::string &key);
+    void record_failure(const std::string &key);
+
+  private:
+    enum class State { CLOSED, OPEN, HALF_OPEN };
+
+    struct Breaker {
+        State state = State::CLOSED;
+        int failures = 0;
+        // when it opened, or when the probe went out
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::map<std::string, Breaker> breakers;
+    std::mutex mtx;
+};
+
 bool is_overlapping(std::array<double, 4> x, std::array<double, 4> y);
 Color parseHexColor(const std::string &hexColor);
 
@@ -81,8 +117,26 @@ class Imagery {
     bool ignore_old_radars = false;
     bool stripe_on_old_radars = true;
     int max_concurrent_threads = 7;
-
-    std::vector<RadarImage *> used_radars;
+    // who draws which pixel out of one label map of the whole render instead of every radar solving
+    // its own borders, see label_coverage. RadarBench coverage compares the two
+    bool single_pass_coverage = false;
+    // aborts every outstanding download of this render once expired or cancelled
+    std::shared_ptr<fetch::Deadline> deadline;
+    // how long the radar downloads of a render may take, 0 waits for all of them. once it's
+    // over the composite is made of whatever arrived, and a failed radar no longer fails the render
+    std::chrono::milliseconds latency_budget{0};
+
+    // from the catalog snapshot the render used, still good after the catalog moved on
+    std::vector<std::shared_ptr<const RadarImage>> used_radars;
+    // radar code -> why it couldn't be fetched or parsed
+    std::map<std::string, std::string> fetch_errors;
+    // radar codes left out because they, or their host, kept failing lately. see CircuitBreaker
+    std::vector<std::string> skipped_radars;
+    // radar codes in range that didn't make it into the composite, too late or failed
+    std::vector<std::string> missing_radars;
+    // radar codes in range that couldn't have put a single pixel on the map, never fetched. unless
+    // the radar covering one of them didn't make it in, then it's fetched and drawn after all
+    std::vector<std::string> culled_radars;
 
     int zoom_level = 13;
     int check_radar_dist_every_px = 10;
@@ -99,12 +153,46 @@ class Imagery {
     }
 
   private:
-    void render_loop(int width, int height, std::vector<radar::RadarImage> &radars, std::vector<std::string> &raw_images,
-        cv::Mat &container, int i, std::mutex &mtx, bool *is_done);
+    void render_loop(int width, int height, const std::vector<std::shared_ptr<const RadarImage>> &radars,
+        const std::vector<cv::Mat> &frames, cv::Mat &container, int i, std::mutex &mtx, bool *is_done);
     std::array<double, 4> boundaries;
-    std::vector<RadarImage> radar_datas;
-    std::vector<RadarImage> &get_radar_datas();
-    void fetch_detailed_data(std::string code, std::mutex &mtx, std::string &runtime_error, int index);
+    // deadline, or the latency budget if that ends first
+    std::shared_ptr<fetch::Deadline> fetch_deadline;
+    std::vector<std::shared_ptr<const RadarImage>> radar_datas;
+    // of the catalog radar_datas came from, and where each of its radars is in radar_datas
+    std::shared_ptr<const RadarIndex> radar_index;
+    std::map<std::string, int> radar_positions;
+
+    // all render_loop's geometry needs of each radar of this render, by position in radar_datas.
+    // built once per render, so the pixel loops never look at a RadarImage or a map
+    struct Geometry {
+        std::vector<double> lon;
+        std::vector<double> lat;
+        std::vector<double> range;
+        std::vector<int> priority;
+        std::vector<char> stale;
+        double max_range = 0;
+    };
+    Geometry geometry;
+    // by position in radar_datas, when single_pass_coverage
+    std::vector<std::shared_ptr<const Ownership>> coverage;
+    void build_geometry(const std::vector<std::shared_ptr<const RadarImage>> &radars);
+    PositionalData position_of(int i);
+    std::shared_ptr<const Ownership> solved_ownership(int width, int height, int i);
+    void label_ownership(int width, int height);
+    std::vector<std::shared_ptr<const RadarImage>> &get_radar_datas();
+    void cull_radars();
+    // culled radars all of whose part of the map a higher priority radar covers, and that radar's code
+    std::vector<std::shared_ptr<const RadarImage>> covered_radars;
+    std::map<std::string, std::string> covered_by;
+    std::string load_frames(const std::vector<std::shared_ptr<const RadarImage>> &radars, std::vector<cv::Mat> &frames,
+        std::vector<bool> &arrived);
+    std::string reinstate_covered(std::vector<std::shared_ptr<const RadarImage>> &radars, std::vector<cv::Mat> &frames,
+        std::vector<bool> &arrived);
+    double range_of(const RadarImage &radar);
+    int priority_of(const RadarImage &radar);
+    void record_failure(const std::string &code);
+    void record_hosts(const std::map<std::string, bool> &host_answered);
 };
 
 } // namespace radar
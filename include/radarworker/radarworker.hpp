@@ -1,8 +1,14 @@
 #ifndef RADARWORKER_HPP
 #define RADARWORKER_HPP
 
+#include <radarworker/catalog.hpp>
+#include <radarworker/frames.hpp>
 #include <radarworker/map.hpp>
+#include <radarworker/ownership.hpp>
 #include <radarworker/png.hpp>
+#include <radarworker/prefetch.hpp>
 #include <radarworker/radar.hpp>
+#include <radarworker/spatial.hpp>
+#include <radarworker/store.hpp>
 
 #endif
\ No newline at end of file
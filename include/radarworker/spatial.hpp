@@ -0,0 +1,52 @@
+#ifndef SPATIAL_HPP
+#define SPATIAL_HPP
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace radar {
+struct RadarList;
+
+// uniform grid over the radars of one list, by their image bounds and by their position,
+// so picking the radars of a viewport or the neighbours of a radar only looks at the few
+// cells around it instead of every station. built once per catalog snapshot, read-only after
+class RadarIndex {
+  public:
+    // cell_size in degrees, about a quarter of an image's width by default
+    explicit RadarIndex(const std::vector<RadarList> &list, double cell_size = 1.0);
+
+    // positions in the list of every radar whose image overlaps bounds (north, west, south, east),
+    // in list order
+    std::vector<int> overlapping(const std::array<double, 4> &bounds) const;
+    // positions in the list of every radar less than distance degrees away from lat/lon, in list order
+    std::vector<int> within(double lat, double lon, double distance) const;
+
+    const std::string &code(int position) const { return entries.at(position).code; }
+
+  private:
+    struct Entry {
+        std::string code;
+        double lat;
+        double lon;
+        std::array<double, 4> bounds;
+    };
+
+    // cells covering [south, north] x [west, east], clamped to the grid
+    template <typename F> void for_cells(double north, double west, double south, double east, F visit) const;
+    int cell_row(double lat) const;
+    int cell_col(double lon) const;
+
+    double cell_size;
+    double origin_lat = 0;
+    double origin_lon = 0;
+    int rows = 0;
+    int cols = 0;
+    std::vector<Entry> entries;
+    // row-major, positions in the list
+    std::vector<std::vector<int>> bounds_cells;
+    std::vector<std::vector<int>> position_cells;
+};
+} // namespace radar
+
+#endif
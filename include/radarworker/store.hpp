@@ -0,0 +1,56 @@
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <mutex>
+#include <radarworker/fetch.hpp>
+#include <string>
+
+namespace radar {
+// radar frames and metadata on disk, so a restart or a deploy doesn't start from nothing.
+// a frame is stored as downloaded, by station and frame time. those never change once
+// published, so one stays until it's older than max_age or the store grows past max_bytes.
+// the radar list and each station's latest detail are stored as their raw responses
+class FrameStore {
+  public:
+    // next to the tile cache
+    boost::filesystem::path directory = boost::filesystem::current_path() / ".cache" / "radar";
+    std::chrono::hours max_age{24};
+    unsigned long long max_bytes = 1024ULL * 1024 * 1024;
+    // how often prune_if_due actually prunes
+    std::chrono::minutes prune_interval{10};
+
+    static FrameStore &global();
+
+    // false if it isn't stored
+    bool read_frame(const std::string &code, std::chrono::system_clock::time_point time, fetch::Buffer &data);
+    void write_frame(const std::string &code, std::chrono::system_clock::time_point time, const fetch::Buffer &data);
+    // e.g. one that doesn't decode
+    void remove_frame(const std::string &code, std::chrono::system_clock::time_point time);
+
+    // modified is when it was written
+    bool read_list(fetch::Buffer &data, std::chrono::system_clock::time_point &modified);
+    void write_list(const fetch::Buffer &data);
+    bool read_detail(const std::string &code, fetch::Buffer &data);
+    void write_detail(const std::string &code, const fetch::Buffer &data);
+
+    // frames past max_age first, then the oldest ones until it fits in max_bytes. walks the whole
+    // directory, so it's left to the catalog's refresher instead of anything a render waits on
+    void prune();
+    void prune_if_due();
+
+  private:
+    FrameStore() {}
+
+    boost::filesystem::path frame_path(const std::string &code, std::chrono::system_clock::time_point time);
+    bool read(const boost::filesystem::path &path, fetch::Buffer &data);
+    void write(const boost::filesystem::path &path, const fetch::Buffer &data);
+
+    std::chrono::steady_clock::time_point last_prune;
+    bool pruned = false;
+    std::mutex mtx;
+};
+} // namespace radar
+
+#endif
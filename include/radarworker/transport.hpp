@@ -0,0 +1,109 @@
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <radarworker/fetch.hpp>
+
+namespace fetch {
+// name of the fixture file a request is recorded to and replayed from. any token= query
+// parameter is left out, so fixtures don't carry the token and replay without one
+std::string fixture_name(const std::string &url, const Options &options);
+
+// passes everything on to another transport and saves every successful response
+// to a fixture directory, for Replayer to serve later. the files are written on a thread
+// of its own, the live transport's callbacks only queue them up
+class Recorder : public Transport {
+  public:
+    Recorder(std::string directory, std::shared_ptr<Transport> live);
+    // whatever's still queued is written first
+    ~Recorder();
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    void submit(const std::string &url, const Options &options, Callback on_complete) override;
+    Stats stats() override { return live->stats(); }
+
+  private:
+    struct Fixture {
+        std::string name;
+        std::string url;
+        Buffer body;
+    };
+
+    void run();
+    void save(const Fixture &fixture);
+
+    std::string directory;
+    std::shared_ptr<Transport> live;
+    std::deque<Fixture> unsaved;
+    bool stopping = false;
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    std::thread writer;
+};
+
+struct ReplayConfig {
+    // every response takes this long, plus anywhere up to latency_jitter_ms more
+    long latency_ms = 0;
+    long latency_jitter_ms = 0;
+    // chance of a response failing instead, 0 to 1
+    double failure_rate = 0;
+};
+
+// serves responses recorded by Recorder, never touches the network. anything that
+// wasn't recorded fails like a transfer would
+class Replayer : public Transport {
+  public:
+    Replayer(std::string directory, ReplayConfig config = ReplayConfig());
+    ~Replayer();
+
+    Replayer(const Replayer &) = delete;
+    Replayer &operator=(const Replayer &) = delete;
+
+    void submit(const std::string &url, const Options &options, Callback on_complete) override;
+    Stats stats() override;
+
+  private:
+    struct Response {
+        std::string url;
+        std::string site;
+        Buffer body;
+        std::exception_ptr error;
+        std::shared_ptr<Deadline> deadline;
+        Callback on_complete;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    bool load(const std::string &name, Buffer &body);
+    void run();
+
+    std::string directory;
+    ReplayConfig config;
+    Stats counters;
+    std::mt19937 rng;
+    std::map<std::string, Buffer> loaded;
+    // ordered by when they're due
+    std::multimap<std::chrono::steady_clock::time_point, Response> due;
+    bool stopping = false;
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    std::thread worker;
+};
+
+// Replayer for fetch_replay=<dir> (tuned by fetch_replay_latency_ms, fetch_replay_jitter_ms
+// and fetch_replay_failure_rate), Recorder over Client::global() for fetch_record=<dir>,
+// Client::global() otherwise
+std::shared_ptr<Transport> transport_from_env();
+} // namespace fetch
+
+#endif
@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <curl/curl.h>
+#include <date/date.h>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <radarworker/catalog.hpp>
+#include <radarworker/fetch.hpp>
+#include <radarworker/ownership.hpp>
+
+using json = nlohmann::json;
+
+static size_t discard(char *, size_t size, size_t nmemb, void *) {
+    return size * nmemb;
+}
+
+// what fetch::get used to do: one thread and one fresh handle per tile, nothing reused
+static void fetch_thread_per_url(const std::vector<std::string> &urls) {
+    std::vector<std::thread> jobs;
+    for (auto &url : urls) {
+        jobs.push_back(std::thread([url] {
+            CURL *handle = curl_easy_init();
+            curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+            curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+            curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, discard);
+            curl_easy_perform(handle);
+            curl_easy_cleanup(handle);
+        }));
+    }
+
+    for (auto &job : jobs) {
+        job.join();
+    }
+}
+
+static void fetch_with_client(fetch::Client &client, const std::vector<std::string> &urls, bool multiplex) {
+    fetch::Options options;
+    options.multiplex = multiplex;
+
+    std::vector<std::future<fetch::Buffer>> downloads;
+    for (auto &url : urls) {
+        downloads.push_back(client.get_async(url, options));
+    }
+
+    for (auto &download : downloads) {
+        download.get();
+    }
+}
+
+template <typename F> static void run(const std::string &name, int rounds, F job) {
+    std::vector<double> times;
+    for (int i = 0; i < rounds; i++) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            job();
+        } catch (std::runtime_error &e) {
+            std::cout << name << ": " << e.what() << std::endl;
+            return;
+        }
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        times.push_back(elapsed.count());
+    }
+
+    double first = times.front();
+    std::sort(times.begin(), times.end());
+    double median = times.at(times.size() / 2);
+
+    std::cout << name << ": first " << first << " ms, median " << median << " ms over " << rounds << " rounds" << std::endl;
+}
+
+// wall-clock time to download one render worth of tiles, per fetch strategy.
+// point it at a local stand-in that answers every /z/x/y.png path over both HTTP/1.1 and HTTP/2,
+// bench_tiles_server.sh starts one with fixed tile payloads
+static int bench_tiles(const std::string &base_url, int tiles, int rounds) {
+    std::vector<std::string> urls;
+    for (int i = 0; i < tiles; i++) {
+        urls.push_back(base_url + "/14/" + std::to_string(13000 + i % 20) + "/" + std::to_string(8400 + i / 20) + ".png");
+    }
+
+    bool cleartext = base_url.rfind("http://", 0) == 0;
+
+    // HTTP/2 first, the HTTP/1.1 client never picks up its connection from the shared cache
+    fetch::Config h2_config;
+    h2_config.http_version = cleartext ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS;
+    fetch::Client h2_client(h2_config);
+    run("HTTP/2 multiplexed", rounds, [&] { fetch_with_client(h2_client, urls, true); });
+
+    fetch::Config h1_config;
+    h1_config.http_version = CURL_HTTP_VERSION_1_1;
+    fetch::Client h1_client(h1_config);
+    run("HTTP/1.1 pooled", rounds, [&] { fetch_with_client(h1_client, urls, false); });
+
+    run("HTTP/1.1 thread per tile", rounds, [&] { fetch_thread_per_url(urls); });
+
+    return 0;
+}
+
+// what parse_radar_list and parse_radar_detail used to do: the whole response as a JSON tree,
+// fields pulled out of it one by one and every time through a stream
+static std::vector<radar::RadarList> dom_parse_radar_list(const fetch::Buffer &content) {
+    std::vector<radar::RadarList> list;
+
+    json list_data;
+    try {
+        list_data = json::parse(content.data(), content.data() + content.size());
+    } catch (const json::parse_error &e) {
+        std::string err(e.what());
+        throw std::runtime_error("Error parsing JSON: " + err);
+    }
+
+    for (auto &radar : list_data["datas"]) {
+        auto tlc_raw = radar["overlayTLC"];
+        auto brc_raw = radar["overlayBRC"];
+
+        double north = std::stod(static_cast<std::string>(tlc_raw[0]));
+        double west = std::stod(static_cast<std::string>(tlc_raw[1]));
+        double south = std::stod(static_cast<std::string>(brc_raw[0]));
+        double east = std::stod(static_cast<std::string>(brc_raw[1]));
+
+        std::string kota = static_cast<std::string>(radar["Kota"]);
+        std::string stasiun = static_cast<std::string>(radar["Stasiun"]);
+        std::string kode = static_cast<std::string>(radar["kode"]);
+        double lat = radar["lat"];
+        double lon = radar["lon"];
+
+        radar::RadarList radar_data;
+        radar_data.boundaries = {north, west, south, east};
+        radar_data.kota = kota;
+        radar_data.stasiun = stasiun;
+        radar_data.kode = kode;
+        radar_data.lat = lat;
+        radar_data.lon = lon;
+
+        list.push_back(radar_data);
+    }
+
+    return list;
+}
+
+static bool dom_parse_radar_detail(const fetch::Buffer &content, radar::RadarImage &radar_data) {
+    json parsed_data;
+    try {
+        parsed_data = json::parse(content.data(), content.data() + content.size());
+    } catch (const json::parse_error &e) {
+        std::string err(e.what());
+        throw std::runtime_error("Error parsing JSON: " + err);
+    }
+
+    if (parsed_data.is_null()) {
+        throw std::runtime_error("Radar image API returned NULL");
+    }
+
+    if (parsed_data["Latest"]["timeUTC"] == "No Data") {
+        return false;
+    }
+
+    auto tlc_raw = parsed_data["bounds"]["overlayTLC"];
+    auto brc_raw = parsed_data["bounds"]["overlayBRC"];
+
+    double north = std::stod(static_cast<std::string>(tlc_raw[0]));
+    double west = std::stod(static_cast<std::string>(tlc_raw[1]));
+    double south = std::stod(static_cast<std::string>(brc_raw[0]));
+    double east = std::stod(static_cast<std::string>(brc_raw[1]));
+
+    radar_data.boundaries = {north, west, south, east};
+    radar_data.kode = parsed_data["bounds"]["kode"];
+    radar_data.kota = parsed_data["bounds"]["Kota"];
+    radar_data.stasiun = parsed_data["bounds"]["Stasiun"];
+    radar_data.lat = parsed_data["bounds"]["lat"];
+    radar_data.lon = parsed_data["bounds"]["lon"];
+
+    auto last_1h = parsed_data["LastOneHour"];
+    std::vector<std::chrono::system_clock::time_point> time;
+    std::vector<std::string> file;
+
+    for (auto &color : parsed_data["legends"]["colors"]) {
+        radar_data.colors.push_back(radar::parseHexColor(color));
+    }
+
+    for (int i = 0; i < last_1h["file"].size(); i++) {
+        std::istringstream in{static_cast<std::string>(last_1h["timeUTC"][i])};
+        std::chrono::system_clock::time_point tp;
+        in >> date::parse("%Y-%m-%d %H:%M %Z", tp);
+        std::string filename = last_1h["file"][i];
+
+        time.push_back(tp);
+        file.push_back(filename);
+    }
+
+    if (time.empty()) {
+        return false;
+    }
+
+    radar_data.data.file = file;
+    radar_data.data.time = time;
+    return true;
+}
+
+static bool same_colors(const std::vector<radar::Color> &x, const std::vector<radar::Color> &y) {
+    return std::equal(x.begin(), x.end(), y.begin(), y.end(), [](const radar::Color &a, const radar::Color &b) {
+        return a.r == b.r && a.g == b.g && a.b == b.b;
+    });
+}
+
+static bool same_detail(const radar::RadarImage &x, const radar::RadarImage &y) {
+    return x.kode == y.kode && x.kota == y.kota && x.stasiun == y.stasiun && x.lat == y.lat && x.lon == y.lon &&
+           x.boundaries == y.boundaries && same_colors(x.colors, y.colors) && x.data.time == y.data.time &&
+           x.data.file == y.data.file;
+}
+
+static bool same_list(const std::vector<radar::RadarList> &x, const std::vector<radar::RadarList> &y) {
+    return std::equal(x.begin(), x.end(), y.begin(), y.end(), [](const radar::RadarList &a, const radar::RadarList &b) {
+        return a.kode == b.kode && a.kota == b.kota && a.stasiun == b.stasiun && a.lat == b.lat && a.lon == b.lon &&
+               a.boundaries == b.boundaries;
+    });
+}
+
+// time to parse every radar list and detail in a fixture directory recorded with fetch_record=<dir>
+static int bench_json(const std::string &fixture_dir, int rounds) {
+    std::vector<fetch::Buffer> lists;
+    std::vector<fetch::Buffer> details;
+
+    // the recorder's index says which fixture is which
+    std::ifstream index((boost::filesystem::path(fixture_dir) / "index").string());
+    std::string name, url;
+    while (index >> name >> url) {
+        boost::filesystem::path path = boost::filesystem::path(fixture_dir) / name;
+        auto bytes = std::make_shared<std::vector<unsigned char>>(boost::filesystem::file_size(path));
+        std::ifstream input_file(path.string(), std::ios::binary);
+        input_file.read(reinterpret_cast<char *>(bytes->data()), bytes->size());
+
+        if (url.find(radar::RADAR_LIST_API_URL) == 0) {
+            lists.push_back(fetch::Buffer(bytes));
+        } else if (url.find("?radar=") != std::string::npos) {
+            details.push_back(fetch::Buffer(bytes));
+        }
+    }
+
+    if (lists.empty() && details.empty()) {
+        std::cout << "No radar list or detail in " << fixture_dir << std::endl;
+        return 1;
+    }
+    std::cout << lists.size() << " lists, " << details.size() << " details" << std::endl;
+
+    // they're only comparable if they agree
+    for (auto &content : lists) {
+        if (!same_list(dom_parse_radar_list(content), radar::parse_radar_list(content))) {
+            std::cout << "Radar lists differ" << std::endl;
+            return 1;
+        }
+    }
+    for (auto &content : details) {
+        radar::RadarImage dom, streamed;
+        bool dom_has_data = dom_parse_radar_detail(content, dom);
+        if (dom_has_data != radar::parse_radar_detail(content, streamed) || (dom_has_data && !same_detail(dom, streamed))) {
+            std::cout << "Radar details differ" << std::endl;
+            return 1;
+        }
+    }
+
+    run("DOM", rounds, [&] {
+        for (auto &content : lists) {
+            dom_parse_radar_list(content);
+        }
+        for (auto &content : details) {
+            radar::RadarImage radar_data;
+            dom_parse_radar_detail(content, radar_data);
+        }
+    });
+
+    run("streaming", rounds, [&] {
+        for (auto &content : lists) {
+            radar::parse_radar_list(content);
+        }
+        for (auto &content : details) {
+            radar::RadarImage radar_data;
+            radar::parse_radar_detail(content, radar_data);
+        }
+    });
+
+    return 0;
+}
+
+// paints every radar's spans over a width x height map, in order like the render jobs would
+static std::vector<int> paint(const std::vector<std::shared_ptr<const radar::Ownership>> &ownerships, int width, int height) {
+    std::vector<int> labels(static_cast<size_t>(width) * height, -1);
+    for (int r = 0; r < ownerships.size(); r++) {
+        const radar::Ownership &ownership = *ownerships.at(r);
+        for (int y = 0; y < height; y++) {
+            for (int span = ownership.row_offsets.at(y); span < ownership.row_offsets.at(y + 1); span += 2) {
+                int start = std::max(0, ownership.spans.at(span));
+                int end = std::min(width, ownership.spans.at(span + 1));
+                std::fill(labels.begin() + y * width + std::min(start, end), labels.begin() + y * width + end, r);
+            }
+        }
+    }
+    return labels;
+}
+
+// time to find every radar's pixels of a square map, solving each radar's borders the way the render
+// jobs do against one label map of the whole map, as the radars and the map grow. made up radars over
+// a 10 degree map, most with BMKG's usual range and every fourth a short range, higher priority one.
+// both run on one thread and without the ownership cache, a render spreads the solving over its jobs
+static int bench_coverage(int rounds) {
+    std::array<double, 4> boundaries = {0.0, 100.0, -10.0, 110.0};
+    std::mt19937 random(2024);
+    std::uniform_real_distribution<double> lat(-12.0, 2.0);
+    std::uniform_real_distribution<double> lon(98.0, 112.0);
+
+    for (int count : {4, 16, 64}) {
+        std::vector<radar::PositionalData> radars;
+        for (int i = 0; i < count; i++) {
+            bool local = i % 4 == 3;
+            radars.push_back({lon(random), lat(random), local ? 85.0 KM : 240.0 KM, local ? 1 : 0, false});
+        }
+
+        for (int size : {512, 1024, 2048}) {
+            auto solve_all = [&] {
+                std::vector<std::shared_ptr<const radar::Ownership>> ownerships;
+                for (int i = 0; i < count; i++) {
+                    std::vector<radar::PositionalData> neighbours = radars;
+                    neighbours.erase(neighbours.begin() + i);
+                    auto rivals = radar::rivals_of(radars.at(i), neighbours);
+                    ownerships.push_back(radar::solve_ownership(boundaries, size, size, radars.at(i), rivals));
+                }
+                return ownerships;
+            };
+            auto label_all = [&] {
+                std::vector<int> labels = radar::label_coverage(boundaries, size, size, radars);
+                return radar::ownership_of_labels(labels, size, size, count);
+            };
+
+            // they're only comparable if they agree, give or take a pixel on the borders
+            std::vector<int> solved = paint(solve_all(), size, size);
+            std::vector<int> labelled = paint(label_all(), size, size);
+            long differ = 0;
+            for (size_t i = 0; i < solved.size(); i++) {
+                differ += solved.at(i) != labelled.at(i);
+            }
+
+            std::string name = std::to_string(count) + " radars, " + std::to_string(size) + "x" + std::to_string(size);
+            std::cout << name << ": " << 100.0 * differ / solved.size() << "% of pixels differ" << std::endl;
+            run(name + " solved", rounds, solve_all);
+            run(name + " labelled", rounds, label_all);
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    std::string desc = "Usage: RadarBench tiles <base url> [tiles=200] [rounds=10]\n"
+                       "       RadarBench json <fixture dir> [rounds=200]\n"
+                       "       RadarBench coverage [rounds=5]";
+    if (argc < 2) {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    std::string bench = argv[1];
+    if (bench == "tiles" && argc > 2) {
+        int tiles = argc > 3 ? std::stoi(argv[3]) : 200;
+        int rounds = argc > 4 ? std::stoi(argv[4]) : 10;
+        return bench_tiles(argv[2], tiles, rounds);
+    }
+    if (bench == "json" && argc > 2) {
+        int rounds = argc > 3 ? std::stoi(argv[3]) : 200;
+        return bench_json(argv[2], rounds);
+    }
+    if (bench == "coverage") {
+        int rounds = argc > 2 ? std::stoi(argv[2]) : 5;
+        return bench_coverage(rounds);
+    }
+
+    std::cout << desc << std::endl;
+    return 1;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# local stand-in for RadarBench tiles: fixed tile payloads served by nghttpd,
+# with nghttpx in front of it answering both HTTP/1.1 and HTTP/2 over TLS (self-signed)
+#
+#   ./bench_tiles_server.sh [port=8443] [tiles=200] [tile bytes=20000]
+#   RadarBench tiles https://127.0.0.1:8443 200 10
+#
+# needs nghttpd and nghttpx (nghttp2) and openssl. ctrl-c stops everything
+set -e
+
+port=${1:-8443}
+tiles=${2:-200}
+size=${3:-20000}
+backend=$((port + 1))
+
+dir=$(mktemp -d)
+trap 'kill $server $proxy 2>/dev/null; rm -rf "$dir"' EXIT INT TERM
+
+# same /14/x/y.png layout bench_tiles asks for, every tile the same fixed bytes
+head -c "$size" /dev/zero | tr '\0' 'x' >"$dir/tile.png"
+i=0
+while [ "$i" -lt "$tiles" ]; do
+    x=$((13000 + i % 20))
+    y=$((8400 + i / 20))
+    mkdir -p "$dir/www/14/$x"
+    cp "$dir/tile.png" "$dir/www/14/$x/$y.png"
+    i=$((i + 1))
+done
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 \
+    -keyout "$dir/key.pem" -out "$dir/cert.pem" 2>/dev/null
+
+nghttpd --no-tls --htdocs="$dir/www" --address=127.0.0.1 "$backend" &
+server=$!
+
+nghttpx --frontend="127.0.0.1,$port" --backend="127.0.0.1,$backend;;proto=h2" --workers=1 --no-ocsp \
+    --log-level=WARN "$dir/key.pem" "$dir/cert.pem" &
+proxy=$!
+
+echo "serving $tiles tiles of $size bytes at https://127.0.0.1:$port"
+wait $proxy
@@ -0,0 +1,633 @@
+#include <algorithm>
+#include <curlpp/cURLpp.hpp>
+#include <date/date.h>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <radarworker/catalog.hpp>
+#include <radarworker/store.hpp>
+
+using json = nlohmann::json;
+
+radar::RadarCatalog &radar::RadarCatalog::global() {
+    // everything the refresher uses has to outlive it, so it has to exist first
+    fetch::transport();
+    CircuitBreaker::global();
+    FrameStore::global();
+
+    static RadarCatalog catalog;
+    return catalog;
+}
+
+radar::RadarCatalog::~RadarCatalog() {
+    mtx.lock();
+    stopping = true;
+    if (refreshing) {
+        refreshing->cancel();
+    }
+    mtx.unlock();
+
+    wakeup.notify_all();
+    published.notify_all();
+    if (refresher.joinable()) {
+        refresher.join();
+    }
+}
+
+std::shared_ptr<const radar::RadarCatalog::Snapshot> radar::RadarCatalog::snapshot(std::shared_ptr<fetch::Deadline> deadline) {
+    std::shared_ptr<const Snapshot> latest = std::atomic_load(&current);
+    if (latest)
+        return latest;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!refresher.joinable() && !stopping) {
+        // what the last run left behind, the refresher replaces it right away. only before it starts,
+        // after that the store has its half-done list in it
+        latest = load_stored();
+        if (latest) {
+            // unless someone else got one in first
+            std::shared_ptr<const Snapshot> none;
+            if (!std::atomic_compare_exchange_strong(&current, &none, latest)) {
+                latest = none;
+            }
+        }
+
+        refresher = std::thread([this] { this->refresh_loop(); });
+    }
+    if (latest)
+        return latest;
+
+    // nothing to go on yet. the refresher gets the first one under its own refresh_timeout, so a
+    // render short on time doesn't cut it short for everyone else. this one waits as long as it may
+    unsigned long failures = failed_refreshes;
+    if (!refreshing) {
+        refresh_now = true;
+        wakeup.notify_all();
+    }
+
+    while (!(latest = std::atomic_load(&current))) {
+        if (stopping)
+            throw std::runtime_error("Radar catalog is shutting down");
+        if (failed_refreshes != failures)
+            throw std::runtime_error(refresh_error);
+        if (deadline && deadline->expired())
+            throw std::runtime_error(deadline->is_cancelled() ? "Cancelled while waiting for the radar catalog"
+                                                              : "Deadline exceeded waiting for the radar catalog");
+
+        // deadlines don't wake us up, same as the fetch client
+        published.wait_for(lock, std::chrono::milliseconds(100));
+    }
+
+    return latest;
+}
+
+std::shared_ptr<const radar::RadarCatalog::Snapshot> radar::RadarCatalog::refresh(std::shared_ptr<fetch::Deadline> deadline) {
+    fetch::Options options;
+    options.deadline = deadline;
+    options.hedge = true;
+    options.retries = 2;
+    options.site = "radar_list";
+
+    FrameStore &store = FrameStore::global();
+    auto next = std::make_shared<Snapshot>();
+    fetch::Buffer list_content = fetch::get_async(RADAR_LIST_API_URL, options).get();
+    next->list = parse_radar_list(list_content);
+    next->index = std::make_shared<RadarIndex>(next->list);
+    store.write_list(list_content);
+
+    std::shared_ptr<const Snapshot> previous = std::atomic_load(&current);
+
+    // kept apart from the radar: breakers of the images, a detail coming through says nothing about those
+    CircuitBreaker &breaker = CircuitBreaker::global();
+    std::map<std::string, bool> host_answered;
+
+    // stale beats nothing, the render decides whether it's too old
+    auto keep_previous = [&](const std::string &code) {
+        if (previous) {
+            auto previous_pos = previous->details.find(code);
+            if (previous_pos != previous->details.end()) {
+                next->details[code] = previous_pos->second;
+            }
+        }
+    };
+
+    // list position of every url
+    std::vector<int> requested;
+    std::vector<std::string> urls;
+    for (int i = 0; i < next->list.size(); i++) {
+        const std::string &code = next->list.at(i).kode;
+        if (!breaker.allow("detail:" + code)) {
+            keep_previous(code);
+            continue;
+        }
+
+        requested.push_back(i);
+        urls.push_back(detailed_data_url(code));
+    }
+
+    options.site = "radar_detail";
+    auto downloads = fetch::get_many(urls, options);
+
+    for (int j = 0; j < downloads.size(); j++) {
+        const std::string &code = next->list.at(requested.at(j)).kode;
+        std::string host = fetch::host_of(urls.at(j));
+
+        // a single radar failing shouldn't take the others down with it
+        try {
+            fetch::Buffer content = downloads.at(j).get();
+            host_answered[host] = true;
+
+            RadarImage radar_data;
+            if (parse_radar_detail(content, radar_data)) {
+                next->details[code] = std::make_shared<const RadarImage>(std::move(radar_data));
+                store.write_detail(code, content);
+            }
+            breaker.record_success("detail:" + code);
+            continue;
+        } catch (std::runtime_error &e) {
+            next->errors[code] = e.what();
+        }
+
+        // running out of time isn't the radar's fault
+        if (!deadline || !deadline->expired()) {
+            breaker.record_failure("detail:" + code);
+            host_answered.emplace(host, false);
+        }
+
+        keep_previous(code);
+    }
+
+    // once per batch, a host that's down fails every radar on it at once and that's still one failure
+    for (auto &host_pos : host_answered) {
+        if (host_pos.second) {
+            breaker.record_success("host:" + host_pos.first);
+        } else {
+            breaker.record_failure("host:" + host_pos.first);
+        }
+    }
+
+    next->refreshed = std::chrono::system_clock::now();
+
+    // the prefetcher may have published newer details while this one was downloading, same
+    // copy, change, swap as update(). whichever detail of a radar is newer stays
+    std::shared_ptr<const Snapshot> published = std::atomic_load(&current);
+    while (true) {
+        auto merged = std::make_shared<Snapshot>(*next);
+        if (published) {
+            for (auto &detail_pos : merged->details) {
+                auto published_pos = published->details.find(detail_pos.first);
+                if (published_pos != published->details.end() &&
+                    published_pos->second->data.time.back() > detail_pos.second->data.time.back()) {
+                    detail_pos.second = published_pos->second;
+                }
+            }
+
+            // failed here, but got through to the prefetcher
+            for (auto &error_pos : merged->errors) {
+                auto published_pos = published->details.find(error_pos.first);
+                if (published_pos != published->details.end()) {
+                    merged->details.emplace(error_pos.first, published_pos->second);
+                }
+            }
+        }
+
+        if (std::atomic_compare_exchange_weak(&current, &published, std::shared_ptr<const Snapshot>(merged)))
+            return merged;
+    }
+}
+
+void radar::RadarCatalog::update(const RadarImage &detail) {
+    auto radar_data = std::make_shared<const RadarImage>(detail);
+    std::shared_ptr<const Snapshot> previous = std::atomic_load(&current);
+
+    // copy, change, swap. if another update or a refresh got in between, again on top of that one
+    while (previous) {
+        auto existing = previous->details.find(detail.kode);
+        if (existing != previous->details.end() && existing->second->data.time.back() >= detail.data.time.back())
+            return;
+
+        auto next = std::make_shared<Snapshot>(*previous);
+        next->details[detail.kode] = radar_data;
+        next->errors.erase(detail.kode);
+        if (std::atomic_compare_exchange_weak(&current, &previous, std::shared_ptr<const Snapshot>(next)))
+            return;
+    }
+}
+
+std::shared_ptr<const radar::RadarCatalog::Snapshot> radar::RadarCatalog::load_stored() {
+    FrameStore &store = FrameStore::global();
+    fetch::Buffer list_content;
+    auto next = std::make_shared<Snapshot>();
+
+    // a render would rather wait for a fresh one than get radars from an hour ago
+    if (!store.read_list(list_content, next->refreshed) ||
+        std::chrono::system_clock::now() - next->refreshed > max_refresh_interval)
+        return nullptr;
+
+    try {
+        next->list = parse_radar_list(list_content);
+        next->index = std::make_shared<RadarIndex>(next->list);
+
+        for (auto &radar : next->list) {
+            fetch::Buffer content;
+            RadarImage radar_data;
+            if (store.read_detail(radar.kode, content) && parse_radar_detail(content, radar_data)) {
+                next->details[radar.kode] = std::make_shared<const RadarImage>(std::move(radar_data));
+            }
+        }
+    } catch (std::exception &e) {
+        log_error(std::string("Stored radar catalog unreadable: ") + e.what());
+        return nullptr;
+    }
+
+    return next;
+}
+
+// right after the next frame is due: the newest frame of any radar plus the usual gap between frames
+std::chrono::seconds radar::RadarCatalog::next_refresh_in(const Snapshot &snapshot) {
+    // the ones that didn't come through get another go soon, not only once the next frame is due
+    if (!snapshot.errors.empty())
+        return min_refresh_interval;
+
+    std::chrono::system_clock::time_point newest;
+    std::vector<long> gaps;
+
+    for (auto &detail_pos : snapshot.details) {
+        auto &time = detail_pos.second->data.time;
+        newest = std::max(newest, time.back());
+
+        for (size_t i = 1; i < time.size(); i++) {
+            long gap = std::chrono::duration_cast<std::chrono::seconds>(time.at(i) - time.at(i - 1)).count();
+            if (gap > 0) {
+                gaps.push_back(gap);
+            }
+        }
+    }
+
+    if (gaps.empty())
+        return min_refresh_interval;
+
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    long gap = gaps.at(gaps.size() / 2);
+
+    // BMKG takes a little while to put a frame up after its timestamp
+    const long PUBLISH_DELAY_SECS = 30;
+    auto due = newest + std::chrono::seconds(gap + PUBLISH_DELAY_SECS);
+    auto wait = std::chrono::duration_cast<std::chrono::seconds>(due - std::chrono::system_clock::now());
+
+    return std::max(min_refresh_interval, std::min(max_refresh_interval, wait));
+}
+
+void radar::RadarCatalog::refresh_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::shared_ptr<const Snapshot> latest = std::atomic_load(&current);
+    // nothing yet, renders are waiting for the first one
+    std::chrono::seconds wait = latest ? next_refresh_in(*latest) : std::chrono::seconds(0);
+    // left over from the last run
+    if (latest && std::chrono::system_clock::now() - latest->refreshed > min_refresh_interval) {
+        wait = std::chrono::seconds(0);
+    }
+
+    while (!stopping) {
+        wakeup.wait_for(lock, wait, [this] { return stopping || refresh_now; });
+        if (stopping)
+            break;
+
+        refresh_now = false;
+        refreshing = std::make_shared<fetch::Deadline>(refresh_timeout);
+        std::shared_ptr<fetch::Deadline> deadline = refreshing;
+        lock.unlock();
+
+        // keep serving the last good one and try again soon
+        wait = min_refresh_interval;
+        std::string error;
+        try {
+            std::shared_ptr<const Snapshot> refreshed = refresh(deadline);
+            wait = next_refresh_in(*refreshed);
+        } catch (std::runtime_error &e) {
+            error = e.what();
+            if (!deadline->is_cancelled()) {
+                log_error("Radar catalog refresh failed: " + error);
+            }
+        }
+
+        lock.lock();
+        refreshing = nullptr;
+        if (error != "") {
+            failed_refreshes++;
+            refresh_error = error;
+        }
+        published.notify_all();
+
+        // nobody's waiting on this thread anymore, unlike the renders that write the frames
+        lock.unlock();
+        FrameStore::global().prune_if_due();
+        lock.lock();
+    }
+}
+
+static std::mutex error_log_mtx;
+static std::function<void(const std::string &)> error_log;
+
+void radar::set_error_log(std::function<void(const std::string &message)> log) {
+    std::lock_guard<std::mutex> lock(error_log_mtx);
+    error_log = std::move(log);
+}
+
+void radar::log_error(const std::string &message) {
+    std::lock_guard<std::mutex> lock(error_log_mtx);
+    if (error_log) {
+        error_log(message);
+    } else {
+        std::cout << message << std::endl;
+    }
+}
+
+std::string radar::detailed_data_url(const std::string &code) {
+    char *token_get = std::getenv("token");
+    std::string token = std::string(token_get == NULL ? "" : token_get);
+
+    std::string URL = token == "" ? radar::RADAR_IMAGE_PUBLIC_API_URL : radar::RADAR_IMAGE_API_URL;
+    URL += "?radar=" + curlpp::escape(code);
+
+    if (token != "") {
+        URL += "&token=" + curlpp::escape(token);
+    }
+
+    return URL;
+}
+
+std::chrono::system_clock::time_point radar::parse_utc_time(const std::string &text) {
+    // YYYY-MM-DD HH:MM, then maybe " UTC"
+    auto digits = [&](size_t pos, size_t count) {
+        int value = 0;
+        for (size_t i = pos; i < pos + count; i++) {
+            if (i >= text.size() || text[i] < '0' || text[i] > '9')
+                return -1;
+            value = value * 10 + (text[i] - '0');
+        }
+        return value;
+    };
+
+    int year = digits(0, 4), month = digits(5, 2), day = digits(8, 2);
+    int hour = digits(11, 2), minute = digits(14, 2);
+    bool separators = text.size() >= 16 && text[4] == '-' && text[7] == '-' && text[10] == ' ' && text[13] == ':';
+    bool suffix = text.size() == 16 || (text.size() > 16 && text.compare(16, std::string::npos, " UTC") == 0);
+
+    date::year_month_day ymd{date::year(year), date::month(month), date::day(day)};
+    if (!separators || !suffix || year < 0 || !ymd.ok() || hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+        throw std::runtime_error("Error parsing time: " + text);
+    }
+
+    return date::sys_days(ymd) + std::chrono::hours(hour) + std::chrono::minutes(minute);
+}
+
+namespace {
+// walks a response without building it, keeping track of where in it each value is,
+// so a handler only picks out what it needs by path
+class PathSax : public json::json_sax_t {
+  public:
+    bool null() override { return scalar(nullptr, 0); }
+    bool boolean(bool) override { return scalar(nullptr, 0); }
+    bool number_integer(number_integer_t val) override { return scalar(nullptr, static_cast<double>(val)); }
+    bool number_unsigned(number_unsigned_t val) override { return scalar(nullptr, static_cast<double>(val)); }
+    bool number_float(number_float_t val, const string_t &) override { return scalar(nullptr, val); }
+    bool string(string_t &val) override { return scalar(&val, 0); }
+    bool binary(binary_t &) override { return scalar(nullptr, 0); }
+
+    bool start_object(std::size_t) override {
+        next();
+        on_object();
+        levels.push_back({"", -1, false});
+        return true;
+    }
+
+    bool key(string_t &val) override {
+        levels.back().key.swap(val);
+        return true;
+    }
+
+    bool end_object() override {
+        levels.pop_back();
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        next();
+        levels.push_back({"", -1, true});
+        return true;
+    }
+
+    bool end_array() override {
+        levels.pop_back();
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &e) override {
+        std::string err(e.what());
+        throw std::runtime_error("Error parsing JSON: " + err);
+    }
+
+  protected:
+    // text is null unless it's a string, number is only set for numbers
+    virtual void on_value(std::string *text, double number) = 0;
+    virtual void on_object() {}
+
+    // whether the current value is at this path, nullptr standing for any element of an array
+    bool at(std::initializer_list<const char *> keys) const {
+        if (keys.size() != levels.size())
+            return false;
+
+        auto level = levels.begin();
+        for (const char *key : keys) {
+            if (key == nullptr ? !level->is_array : level->is_array || level->key != key)
+                return false;
+            level++;
+        }
+
+        return true;
+    }
+
+    // of the current value, if it's an array element
+    int index() const { return levels.empty() ? -1 : levels.back().index; }
+
+    bool is_root() const { return levels.empty(); }
+
+  private:
+    struct Level {
+        std::string key;
+        int index;
+        bool is_array;
+    };
+
+    void next() {
+        if (!levels.empty() && levels.back().is_array) {
+            levels.back().index++;
+        }
+    }
+
+    bool scalar(std::string *text, double number) {
+        next();
+        on_value(text, number);
+        return true;
+    }
+
+    std::vector<Level> levels;
+};
+
+// overlayTLC and overlayBRC come as strings, but a number is fine too
+double coordinate(std::string *text, double number) {
+    if (text == nullptr)
+        return number;
+
+    try {
+        return std::stod(*text);
+    } catch (std::logic_error &e) {
+        throw std::runtime_error("Error parsing coordinate: " + *text);
+    }
+}
+
+class RadarListSax : public PathSax {
+  public:
+    std::vector<radar::RadarList> list;
+
+    void finish() {
+        for (auto &fields : seen) {
+            if (fields != ALL_FIELDS) {
+                throw std::runtime_error("Radar list entry is missing some of its fields");
+            }
+        }
+    }
+
+  protected:
+    void on_object() override {
+        if (at({"datas", nullptr})) {
+            list.emplace_back();
+            seen.push_back(0);
+        }
+    }
+
+    void on_value(std::string *text, double number) override {
+        if (list.empty())
+            return;
+
+        radar::RadarList &radar = list.back();
+        int field = 0;
+
+        if (at({"datas", nullptr, "overlayTLC", nullptr}) && index() < 2) {
+            radar.boundaries[index()] = coordinate(text, number);
+            field = 1 << index();
+        } else if (at({"datas", nullptr, "overlayBRC", nullptr}) && index() < 2) {
+            radar.boundaries[2 + index()] = coordinate(text, number);
+            field = 4 << index();
+        } else if (text != nullptr && at({"datas", nullptr, "Kota"})) {
+            radar.kota = std::move(*text);
+            field = 16;
+        } else if (text != nullptr && at({"datas", nullptr, "Stasiun"})) {
+            radar.stasiun = std::move(*text);
+            field = 32;
+        } else if (text != nullptr && at({"datas", nullptr, "kode"})) {
+            radar.kode = std::move(*text);
+            field = 64;
+        } else if (text == nullptr && at({"datas", nullptr, "lat"})) {
+            radar.lat = number;
+            field = 128;
+        } else if (text == nullptr && at({"datas", nullptr, "lon"})) {
+            radar.lon = number;
+            field = 256;
+        }
+
+        seen.back() |= field;
+    }
+
+  private:
+    static constexpr int ALL_FIELDS = 511;
+    std::vector<int> seen;
+};
+
+class RadarDetailSax : public PathSax {
+  public:
+    radar::RadarImage &radar_data;
+    bool is_null = false;
+    bool no_data = false;
+    int fields = 0;
+    std::vector<std::string> times;
+
+    explicit RadarDetailSax(radar::RadarImage &radar_data) : radar_data(radar_data) {}
+
+  protected:
+    void on_value(std::string *text, double number) override {
+        if (is_root()) {
+            is_null = text == nullptr;
+        } else if (text != nullptr && at({"Latest", "timeUTC"})) {
+            no_data = *text == "No Data";
+        } else if (at({"bounds", "overlayTLC", nullptr}) && index() < 2) {
+            radar_data.boundaries[index()] = coordinate(text, number);
+            fields |= 1 << index();
+        } else if (at({"bounds", "overlayBRC", nullptr}) && index() < 2) {
+            radar_data.boundaries[2 + index()] = coordinate(text, number);
+            fields |= 4 << index();
+        } else if (text != nullptr && at({"bounds", "kode"})) {
+            radar_data.kode = std::move(*text);
+            fields |= 16;
+        } else if (text != nullptr && at({"bounds", "Kota"})) {
+            radar_data.kota = std::move(*text);
+            fields |= 32;
+        } else if (text != nullptr && at({"bounds", "Stasiun"})) {
+            radar_data.stasiun = std::move(*text);
+            fields |= 64;
+        } else if (text == nullptr && at({"bounds", "lat"})) {
+            radar_data.lat = number;
+            fields |= 128;
+        } else if (text == nullptr && at({"bounds", "lon"})) {
+            radar_data.lon = number;
+            fields |= 256;
+        } else if (text != nullptr && at({"legends", "colors", nullptr})) {
+            radar_data.colors.push_back(radar::parseHexColor(*text));
+        } else if (text != nullptr && at({"LastOneHour", "timeUTC", nullptr})) {
+            times.push_back(std::move(*text));
+        } else if (text != nullptr && at({"LastOneHour", "file", nullptr})) {
+            radar_data.data.file.push_back(std::move(*text));
+        }
+    }
+};
+} // namespace
+
+std::vector<radar::RadarList> radar::parse_radar_list(const fetch::Buffer &content) {
+    RadarListSax handler;
+    json::sax_parse(content.data(), content.data() + content.size(), &handler);
+    handler.finish();
+
+    return std::move(handler.list);
+}
+
+bool radar::parse_radar_detail(const fetch::Buffer &content, RadarImage &radar_data) {
+    RadarImage parsed;
+    RadarDetailSax handler(parsed);
+    json::sax_parse(content.data(), content.data() + content.size(), &handler);
+
+    if (handler.is_null) {
+        throw std::runtime_error("Radar image API returned NULL");
+    }
+
+    if (handler.no_data) {
+        return false;
+    }
+
+    if (handler.fields != 511) {
+        throw std::runtime_error("Radar image API response is missing some of its bounds");
+    }
+
+    // a frame without a time can't be placed, the list is cut at whichever runs out first
+    size_t frames = std::min(handler.times.size(), parsed.data.file.size());
+    if (frames == 0) {
+        return false;
+    }
+
+    parsed.data.file.resize(frames);
+    for (size_t i = 0; i < frames; i++) {
+        parsed.data.time.push_back(parse_utc_time(handler.times.at(i)));
+    }
+
+    radar_data = std::move(parsed);
+    return true;
+}
@@ -1,73 +1,926 @@
-
-#include <chrono>
-#include <curlpp/Easy.hpp>
-#include <curlpp/Options.hpp>
-#include <curlpp/cURLpp.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <curl/curl.h>
+#include <memory>
+#include <random>
 #include <radarworker/fetch.hpp>
-#include <sstream>
-#include <thread>
+#include <radarworker/transport.hpp>
+#include <stdexcept>
 
-std::string fetch::get(std::string url, std::list<std::string> headers) {
-    curlpp::initialize();
-    std::stringstream response;
-    std::stringstream *rp = &response;
-
-    std::string runtime_error("");
-    std::string *re = &runtime_error;
-
-    bool done = false;
-    bool *dp = &done;
-
-    std::thread job([url, rp, re, dp, headers] {
-        try {
-            curlpp::Easy req;
-            curlpp::options::Url url_options(url);
-            curlpp::options::SslVerifyPeer ssl_verify_peer(false);
-            curlpp::options::SslVerifyHost ssl_verify_host(false);
-            curlpp::options::HttpHeader http_header(headers);
-
-            req.setOpt(url_options);
-
-            // well, it seems like it doesn't recognize ssl certificate on non-443 port
-            // whatever, i don't care
-            req.setOpt(ssl_verify_peer);
-            req.setOpt(ssl_verify_host);
-            req.setOpt(http_header);
-
-            curlpp::options::WriteStream write(rp);
-            req.setOpt(write);
-
-            req.perform();
-        } catch (curlpp::RuntimeError &e) {
-            *re = e.what();
-        } catch (curlpp::LogicError &e) {
-            *re = e.what();
-        }
-        *dp = true;
+struct ResponseBody {
+    CURL *handle = nullptr;
+    std::shared_ptr<std::vector<unsigned char>> bytes = std::make_shared<std::vector<unsigned char>>();
+};
+
+struct Waiter {
+    fetch::Callback on_complete;
+    std::shared_ptr<fetch::Deadline> deadline;
+};
+
+struct fetch::Client::Transfer {
+    std::string key;
+    std::string url;
+    std::string host;
+    unsigned long seq = 0;
+    Options options;
+    // everyone who asked for this while it was in flight, they all get the same buffer
+    std::vector<Waiter> waiters;
+    // every waiter's deadline is gone, nobody wants the result anymore
+    bool abandoned = false;
+    // running right now, two of them once hedged
+    std::vector<Attempt *> attempts;
+    int retried = 0;
+    bool hedged = false;
+};
+
+// one easy handle sending the transfer's request
+struct fetch::Client::Attempt {
+    Transfer *transfer = nullptr;
+    curl_slist *header_list = nullptr;
+    CURL *handle = nullptr;
+    ResponseBody body;
+    char error[CURL_ERROR_SIZE] = {0};
+    std::chrono::steady_clock::time_point started;
+    bool is_hedge = false;
+};
+
+void fetch::Histogram::record(double ms) {
+    // bucket i holds everything up to 1.5^i ms
+    size_t bucket = 0;
+    if (ms > 1) {
+        bucket = std::min(buckets.size() - 1, static_cast<size_t>(std::ceil(std::log(ms) / std::log(1.5))));
+    }
+
+    buckets[bucket]++;
+    samples++;
+    sum += ms;
+}
+
+double fetch::Histogram::percentile(double p) const {
+    if (samples == 0)
+        return 0;
+
+    unsigned long rank = std::max(1UL, static_cast<unsigned long>(std::ceil(p * samples)));
+    unsigned long seen = 0;
+    size_t bucket = 0;
+    for (; bucket < buckets.size() - 1; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank)
+            break;
+    }
+
+    return std::pow(1.5, bucket);
+}
+
+long fetch::Deadline::remaining_ms() const {
+    if (is_cancelled())
+        return 0;
+    if (at == std::chrono::steady_clock::time_point::max())
+        return LONG_MAX;
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(at - std::chrono::steady_clock::now());
+    return std::max(0L, static_cast<long>(remaining.count()));
+}
+
+// writes straight into the buffer that ends up in the decoder, reserved up front
+// from Content-Length so a large image isn't grown chunk by chunk
+static size_t write_callback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    ResponseBody *body = static_cast<ResponseBody *>(userdata);
+    std::vector<unsigned char> &bytes = *body->bytes;
+
+    if (bytes.capacity() == 0) {
+        curl_off_t length = -1;
+        curl_easy_getinfo(body->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        if (length > 0) {
+            bytes.reserve(length);
+        }
+    }
+
+    bytes.insert(bytes.end(), ptr, ptr + size * nmemb);
+    return size * nmemb;
+}
+
+static void format_timings(std::string &out, const std::string &label, const fetch::Timings &timings) {
+    char line[512];
+    snprintf(line, sizeof(line),
+             "fetch %s count=%lu dns_p95=%.0f connect_p95=%.0f tls_p95=%.0f server_p50=%.0f server_p95=%.0f "
+             "transfer_p95=%.0f total_p50=%.0f total_p95=%.0f bytes_mean=%.0f bytes_saved=%llu\n",
+             label.c_str(), timings.total.count(), timings.dns.percentile(0.95), timings.connect.percentile(0.95),
+             timings.tls.percentile(0.95), timings.server.percentile(0.5), timings.server.percentile(0.95),
+             timings.transfer.percentile(0.95), timings.total.percentile(0.5), timings.total.percentile(0.95),
+             timings.bytes.mean(), timings.bytes_saved);
+    out += line;
+}
+
+std::string fetch::Stats::report() const {
+    std::string out = "fetch requests=" + std::to_string(requests) + " connections_opened=" +
+                      std::to_string(connections_opened) + " connections_reused=" + std::to_string(connections_reused) +
+                      " coalesced=" + std::to_string(coalesced) + " retries=" + std::to_string(retries) +
+                      " hedges=" + std::to_string(hedges) + " hedges_won=" + std::to_string(hedges_won) +
+                      " bytes_downloaded=" + std::to_string(bytes_downloaded) + " bytes_saved=" + std::to_string(bytes_saved) +
+                      "\n";
+
+    for (auto &host_pos : timings_by_host) {
+        format_timings(out, "host=" + host_pos.first, host_pos.second);
+    }
+    for (auto &site_pos : timings_by_site) {
+        format_timings(out, "site=" + site_pos.first, site_pos.second);
+    }
+
+    return out;
+}
+
+std::string fetch::host_of(const std::string &url) {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    size_t end = url.find_first_of(":/?#", start);
+
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    return host;
+}
+
+std::string fetch::request_key(const std::string &url, const Options &options) {
+    std::string key = url;
+    for (auto &header : options.headers) {
+        key += "\n" + header;
+    }
+
+    return key;
+}
+
+// worth another go: the connection broke, timed out, or the server said it's overloaded
+static bool is_retryable(CURLcode result, long status) {
+    switch (result) {
+    case CURLE_OK:
+        return status >= 500 || status == 429;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// exponential, with full +-50% jitter so a burst of failures doesn't come back as another burst
+static long backoff_ms(long base_ms, int retried) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(0.5, 1.5);
+
+    double backoff = static_cast<double>(base_ms) * std::pow(2.0, retried);
+    return static_cast<long>(backoff * jitter(rng));
+}
+
+static std::exception_ptr deadline_error(const fetch::Deadline &deadline, const std::string &url) {
+    std::string err = deadline.is_cancelled() ? "Transfer cancelled" : "Deadline exceeded";
+    return std::make_exception_ptr(std::runtime_error(err + " (" + url + ")"));
+}
+
+// process-wide DNS cache and TLS session cache, shared by every easy handle of every client
+// so a host is only resolved and fully shaken hands with once. connections themselves stay
+// in each client's multi handle, curl can't share those between threads and needs them
+// there to multiplex HTTP/2 streams
+static CURLSH *shared_handle() {
+    static std::mutex locks[CURL_LOCK_DATA_LAST];
+    static CURLSH *share = [] {
+        CURLSH *share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, +[](CURL *, curl_lock_data data, curl_lock_access, void *) {
+            locks[data].lock();
+        });
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, +[](CURL *, curl_lock_data data, void *) { locks[data].unlock(); });
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        return share;
+    }();
+
+    return share;
+}
+
+fetch::Client::Client(Config config) : config(config) {
+    static std::once_flag curl_initialized;
+    std::call_once(curl_initialized, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+    shared_handle();
+
+    multi = curl_multi_init();
+    if (multi == nullptr) {
+        throw std::runtime_error("Unable to create curl multi handle");
+    }
+
+    io_thread = std::thread([this] { this->io_loop(); });
+}
+
+fetch::Client::~Client() {
+    mtx.lock();
+    stopping = true;
+    mtx.unlock();
+
+    curl_multi_wakeup(multi);
+    if (io_thread.joinable()) {
+        io_thread.join();
+    }
+
+    curl_multi_cleanup(multi);
+}
+
+fetch::Client &fetch::Client::global() {
+    static Client client;
+    return client;
+}
+
+void fetch::Client::configure(Config new_config) {
+    mtx.lock();
+    config = new_config;
+    config_dirty = true;
+    mtx.unlock();
+
+    curl_multi_wakeup(multi);
+}
+
+void fetch::Client::submit(const std::string &url, const Options &options, Callback on_complete) {
+    std::string key = request_key(url, options);
+    // the same answer can be a success to one and a failure to the other
+    if (options.fail_on_error) {
+        key += "\nfail_on_error";
+    }
+    Waiter waiter = {std::move(on_complete), options.deadline};
+
+    mtx.lock();
+    if (stopping) {
+        mtx.unlock();
+        waiter.on_complete(url, Buffer(), std::make_exception_ptr(std::runtime_error("HTTP client is shutting down")));
+        return;
+    }
+
+    // the same thing is already on its way, wait for that one instead
+    auto inflight_pos = inflight.find(key);
+    if (inflight_pos != inflight.end()) {
+        inflight_pos->second->waiters.push_back(std::move(waiter));
+        joined.push_back({key, options});
+        counters.coalesced++;
+        mtx.unlock();
+
+        curl_multi_wakeup(multi);
+        return;
+    }
+
+    Transfer *transfer = new Transfer;
+    transfer->key = key;
+    transfer->url = url;
+    transfer->host = host_of(url);
+    transfer->seq = submitted++;
+    transfer->options = options;
+    transfer->waiters.push_back(std::move(waiter));
+
+    inflight[key] = transfer;
+    queue.push_back(transfer);
+    mtx.unlock();
+
+    curl_multi_wakeup(multi);
+}
+
+std::future<fetch::Buffer> fetch::submit_async(Transport &transport, const std::string &url, const Options &options) {
+    auto result = std::make_shared<std::promise<Buffer>>();
+    std::future<Buffer> future = result->get_future();
+
+    transport.submit(url, options, [result](const std::string &url, Buffer body, std::exception_ptr error) {
+        if (error) {
+            result->set_exception(error);
+        } else {
+            result->set_value(std::move(body));
+        }
     });
 
-    auto start_time = std::chrono::high_resolution_clock::now();
-    while (true) {
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    return future;
+}
+
+std::future<fetch::Buffer> fetch::Client::get_async(const std::string &url, const Options &options) {
+    return submit_async(*this, url, options);
+}
+
+fetch::Buffer fetch::Client::get(const std::string &url, const Options &options) {
+    // rethrows the transfer error, if any
+    return get_async(url, options).get();
+}
+
+fetch::Stats fetch::Client::stats() {
+    mtx.lock();
+    Stats copy = counters;
+    mtx.unlock();
+
+    return copy;
+}
+
+void fetch::Client::complete(Transfer *transfer, Buffer body, std::exception_ptr error) {
+    mtx.lock();
+    auto inflight_pos = inflight.find(transfer->key);
+    if (inflight_pos != inflight.end() && inflight_pos->second == transfer) {
+        inflight.erase(inflight_pos);
+    }
+    std::vector<Waiter> waiters = std::move(transfer->waiters);
+    mtx.unlock();
+
+    for (auto &waiter : waiters) {
+        waiter.on_complete(transfer->url, body, error);
+    }
+
+    delete transfer;
+}
+
+void fetch::Client::release(Attempt *attempt) {
+    std::vector<Attempt *> &attempts = attempt->transfer->attempts;
+    attempts.erase(std::remove(attempts.begin(), attempts.end(), attempt), attempts.end());
+
+    active.erase(attempt);
+    hosts[attempt->transfer->host].in_flight--;
+    curl_multi_remove_handle(multi, attempt->handle);
+    curl_easy_cleanup(attempt->handle);
+    curl_slist_free_all(attempt->header_list);
+    delete attempt;
+}
+
+void fetch::Client::expire_waiters() {
+    std::vector<std::pair<Waiter, std::string>> expired;
+    std::vector<Transfer *> abandoned;
+
+    mtx.lock();
+    for (auto inflight_pos = inflight.begin(); inflight_pos != inflight.end();) {
+        Transfer *transfer = inflight_pos->second;
+        std::vector<Waiter> &waiters = transfer->waiters;
+
+        for (auto waiter = waiters.begin(); waiter != waiters.end();) {
+            if (waiter->deadline && waiter->deadline->expired()) {
+                expired.push_back({std::move(*waiter), transfer->url});
+                waiter = waiters.erase(waiter);
+            } else {
+                waiter++;
+            }
+        }
+
+        if (waiters.empty()) {
+            transfer->abandoned = true;
+            abandoned.push_back(transfer);
+            inflight_pos = inflight.erase(inflight_pos);
+        } else {
+            inflight_pos++;
+        }
+    }
+    mtx.unlock();
+
+    for (auto &waiter : expired) {
+        waiter.first.on_complete(waiter.second, Buffer(), deadline_error(*waiter.first.deadline, waiter.second));
+    }
+
+    // the queued ones and the ones backing off are dropped once they come up in admit()
+    for (auto transfer : abandoned) {
+        if (!transfer->attempts.empty()) {
+            while (!transfer->attempts.empty()) {
+                release(transfer->attempts.back());
+            }
+            delete transfer;
+        }
+    }
+}
+
+void fetch::Client::apply_config() {
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, config.max_host_connections);
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, config.max_connections);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, config.max_concurrent_streams);
+    config_dirty = false;
+}
+
+fetch::HostLimit fetch::Client::limit_of(const std::string &host) {
+    mtx.lock();
+    auto limit_pos = config.host_limits.find(host);
+    HostLimit limit = limit_pos != config.host_limits.end() ? limit_pos->second : config.default_host_limit;
+    mtx.unlock();
+
+    return limit;
+}
+
+void fetch::Client::refill(HostQueue &host, const HostLimit &limit) {
+    if (limit.rate <= 0)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (host.refilled == std::chrono::steady_clock::time_point()) {
+        host.tokens = limit.burst;
+    } else {
+        double elapsed = std::chrono::duration<double>(now - host.refilled).count();
+        host.tokens = std::min(limit.burst, host.tokens + elapsed * limit.rate);
+    }
+    host.refilled = now;
+}
+
+// starts whatever each host's limits allow right now. returns how long until
+// a rate limited host gets its next token, or -1 if nothing is waiting on one
+long fetch::Client::admit() {
+    long wait_ms = -1;
+
+    for (auto &host_pos : hosts) {
+        HostQueue &host = host_pos.second;
+        if (host.pending.empty())
+            continue;
+
+        HostLimit limit = limit_of(host_pos.first);
+        refill(host, limit);
+
+        while (!host.pending.empty()) {
+            if (limit.max_in_flight > 0 && host.in_flight >= limit.max_in_flight)
+                break;
+
+            if (limit.rate > 0 && host.tokens < 1) {
+                long next_token_ms = static_cast<long>(std::ceil((1 - host.tokens) / limit.rate * 1000));
+                wait_ms = wait_ms < 0 ? next_token_ms : std::min(wait_ms, next_token_ms);
+                break;
+            }
+
+            Transfer *transfer = host.pending.begin()->second;
+            host.turn[transfer->options.priority] = std::get<1>(host.pending.begin()->first);
+            host.pending.erase(host.pending.begin());
+            // nobody left to take turns with
+            if (host.pending.empty()) {
+                host.turn.clear();
+                host.next_turn.clear();
+            }
+
+            if (start(transfer)) {
+                host.tokens -= 1;
+            }
+        }
+    }
+
+    return wait_ms;
+}
+
+// sends a duplicate of every hedgeable transfer that has been running longer than
+// its host's p95. the duplicate goes through the same host limits as everything else,
+// queued transfers come first
+void fetch::Client::hedge() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<Transfer *> slow;
+
+    mtx.lock();
+    double budget = config.hedge_budget * counters.requests - counters.hedges;
+    for (auto attempt : active) {
+        Transfer *transfer = attempt->transfer;
+        if (!transfer->options.hedge || transfer->hedged)
+            continue;
+
+        auto latency_pos = counters.latency.find(transfer->host);
+        if (latency_pos == counters.latency.end() || latency_pos->second.count() < config.hedge_min_samples)
+            continue;
+
+        double running_ms = std::chrono::duration<double, std::milli>(now - attempt->started).count();
+        if (running_ms > latency_pos->second.percentile(0.95) && budget >= 1) {
+            slow.push_back(transfer);
+            budget -= 1;
+        }
+    }
+    mtx.unlock();
+
+    for (auto transfer : slow) {
+        HostQueue &host = hosts[transfer->host];
+        if (!host.pending.empty())
+            continue;
 
-        if (elapsed.count() > 20000 && !done) {
-            job.detach();
-            runtime_error = "HTTP Request timeout";
-            throw runtime_error;
+        HostLimit limit = limit_of(transfer->host);
+        refill(host, limit);
+
+        if (limit.max_in_flight > 0 && host.in_flight >= limit.max_in_flight)
+            continue;
+        if (limit.rate > 0 && host.tokens < 1)
+            continue;
+
+        if (start(transfer, true)) {
+            host.tokens -= 1;
+            transfer->hedged = true;
+
+            mtx.lock();
+            counters.hedges++;
+            mtx.unlock();
+        }
+    }
+}
+
+// false if no attempt made it to the multi handle
+bool fetch::Client::start(Transfer *transfer, bool is_hedge) {
+    const Options &options = transfer->options;
+
+    mtx.lock();
+    long http_version = config.http_version;
+    std::string accept_encoding = config.accept_encoding;
+    bool abandoned = transfer->abandoned;
+    mtx.unlock();
+
+    if (abandoned) {
+        delete transfer;
+        return false;
+    }
+
+    CURL *handle = curl_easy_init();
+    if (handle == nullptr) {
+        if (transfer->attempts.empty()) {
+            complete(transfer, Buffer(), std::make_exception_ptr(std::runtime_error("Unable to create curl handle")));
+        }
+        return false;
+    }
+
+    Attempt *attempt = new Attempt;
+    attempt->transfer = transfer;
+    attempt->handle = handle;
+    attempt->is_hedge = is_hedge;
+    attempt->started = std::chrono::steady_clock::now();
+
+    for (auto &header : options.headers) {
+        attempt->header_list = curl_slist_append(attempt->header_list, header.c_str());
+    }
+
+    curl_easy_setopt(handle, CURLOPT_URL, transfer->url.c_str());
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, attempt->header_list);
+
+    // well, it seems like it doesn't recognize ssl certificate on non-443 port
+    // whatever, i don't care
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, http_version);
+    // copied by curl, fine to go out of scope
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, accept_encoding.c_str());
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, options.multiplex ? 1L : 0L);
+    curl_easy_setopt(handle, CURLOPT_SHARE, shared_handle());
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, options.connect_timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, options.timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, options.low_speed_limit);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, options.low_speed_time);
+
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &attempt->body);
+    attempt->body.handle = handle;
+    curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, attempt->error);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, attempt);
+
+    transfer->attempts.push_back(attempt);
+    active.insert(attempt);
+    hosts[transfer->host].in_flight++;
+    curl_multi_add_handle(multi, handle);
+    return true;
+}
+
+void fetch::Client::finish(CURL *handle, CURLcode result) {
+    Attempt *attempt = nullptr;
+    curl_easy_getinfo(handle, CURLINFO_PRIVATE, &attempt);
+    Transfer *transfer = attempt->transfer;
+
+    long connects = 0;
+    long status = 0;
+    curl_off_t total_us = 0;
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total_us);
+    bool failed = result != CURLE_OK || is_retryable(result, status) ||
+                  (transfer->options.fail_on_error && status >= 400);
+
+    // every phase is measured from the start of the request, take them apart
+    curl_off_t namelookup_us = 0, connect_us = 0, appconnect_us = 0, starttransfer_us = 0, downloaded = 0;
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &namelookup_us);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect_us);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &appconnect_us);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer_us);
+    curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_off_t connected_us = std::max(connect_us, appconnect_us);
+
+    // the body is decoded by now, downloaded is what actually came over the wire
+    size_t decoded = attempt->body.bytes->size();
+    unsigned long long saved = decoded > static_cast<size_t>(downloaded) ? decoded - downloaded : 0;
+
+    mtx.lock();
+    if (result == CURLE_OK) {
+        counters.bytes_downloaded += downloaded;
+        counters.bytes_saved += saved;
+
+        std::string site = transfer->options.site.empty() ? "other" : transfer->options.site;
+        for (Timings *timings : {&counters.timings_by_host[transfer->host], &counters.timings_by_site[site]}) {
+            if (connects > 0) {
+                timings->dns.record(namelookup_us / 1000.0);
+                timings->connect.record((connect_us - namelookup_us) / 1000.0);
+                if (appconnect_us > 0) {
+                    timings->tls.record((appconnect_us - connect_us) / 1000.0);
+                }
+            }
+            timings->server.record((starttransfer_us - connected_us) / 1000.0);
+            timings->transfer.record((total_us - starttransfer_us) / 1000.0);
+            timings->total.record(total_us / 1000.0);
+            timings->bytes.record(static_cast<double>(downloaded));
+            timings->bytes_saved += saved;
+        }
+    }
+    counters.requests++;
+    counters.connections_opened += connects;
+    if (connects == 0 && result == CURLE_OK) {
+        counters.connections_reused++;
+    }
+    if (!failed) {
+        counters.latency[transfer->host].record(total_us / 1000.0);
+        if (attempt->is_hedge) {
+            counters.hedges_won++;
+        }
+    }
+    mtx.unlock();
+
+    std::string err;
+    if (result != CURLE_OK) {
+        err = attempt->error[0] != '\0' ? attempt->error : curl_easy_strerror(result);
+    } else {
+        err = "HTTP " + std::to_string(status);
+    }
+
+    Buffer body(std::move(attempt->body.bytes));
+    release(attempt);
+
+    if (!failed) {
+        // the other attempt lost the race
+        while (!transfer->attempts.empty()) {
+            release(transfer->attempts.back());
+        }
+        complete(transfer, body, nullptr);
+        return;
+    }
+
+    // the other attempt might still make it
+    if (!transfer->attempts.empty())
+        return;
+
+    if (is_retryable(result, status) && retry(transfer))
+        return;
+
+    complete(transfer, Buffer(), std::make_exception_ptr(std::runtime_error(err + " (" + transfer->url + ")")));
+}
+
+// what a request that joined a transfer in flight asked for, on top of what it already had, see Options
+void fetch::Client::merge(Transfer *transfer, const Options &options) {
+    Options &merged = transfer->options;
+
+    // 0 is no limit
+    auto longer = [](long x, long y) { return x == 0 || y == 0 ? 0 : std::max(x, y); };
+    merged.connect_timeout_ms = longer(merged.connect_timeout_ms, options.connect_timeout_ms);
+    merged.timeout_ms = longer(merged.timeout_ms, options.timeout_ms);
+    merged.retries = std::max(merged.retries, options.retries);
+    merged.hedge = merged.hedge || options.hedge;
+
+    if (options.priority <= merged.priority)
+        return;
+
+    // still waiting at its host, it moves up to the current turn of its new priority. running or
+    // backing off, it only counts from its next attempt
+    HostQueue &host = hosts[transfer->host];
+    for (auto pending_pos = host.pending.begin(); pending_pos != host.pending.end(); pending_pos++) {
+        if (pending_pos->second == transfer) {
+            host.pending.erase(pending_pos);
+            host.pending[std::make_tuple(-options.priority, host.turn[options.priority], transfer->seq)] = transfer;
+            break;
+        }
+    }
+
+    merged.priority = options.priority;
+}
+
+// puts a failed transfer back after its backoff, false once it's out of retries
+bool fetch::Client::retry(Transfer *transfer) {
+    if (transfer->retried >= transfer->options.retries)
+        return false;
+
+    long wait_ms = backoff_ms(transfer->options.retry_backoff_ms, transfer->retried);
+    transfer->retried++;
+    transfer->hedged = false;
+    backoff.insert({std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms), transfer});
+
+    mtx.lock();
+    counters.retries++;
+    mtx.unlock();
+
+    return true;
+}
+
+long fetch::Client::poll_timeout_ms() {
+    // deadlines don't wake us up, so check on them often enough
+    // for every transfer of a render to go down at once
+    long timeout = 1000;
+
+    mtx.lock();
+    for (auto &inflight_pos : inflight) {
+        for (auto &waiter : inflight_pos.second->waiters) {
+            if (waiter.deadline) {
+                timeout = 100;
+            }
+        }
+    }
+    mtx.unlock();
+
+    // same goes for running transfers that may need a hedge
+    for (auto attempt : active) {
+        if (attempt->transfer->options.hedge) {
+            timeout = std::min(timeout, 50L);
         }
+    }
+
+    if (!backoff.empty()) {
+        auto until = backoff.begin()->first - std::chrono::steady_clock::now();
+        long due_ms = std::chrono::duration_cast<std::chrono::milliseconds>(until).count() + 1;
+        timeout = std::max(0L, std::min(timeout, due_ms));
+    }
+
+    return timeout;
+}
+
+void fetch::Client::io_loop() {
+    while (true) {
+        std::deque<Transfer *> incoming;
+        std::vector<std::pair<Transfer *, Options>> joins;
 
-        if (done)
+        mtx.lock();
+        if (stopping) {
+            mtx.unlock();
             break;
+        }
+        if (config_dirty) {
+            apply_config();
+        }
+        incoming.swap(queue);
+        // only this thread deletes transfers, whatever's still in flight now stays around for the merge
+        for (auto &join : joined) {
+            auto inflight_pos = inflight.find(join.first);
+            if (inflight_pos != inflight.end()) {
+                joins.push_back({inflight_pos->second, std::move(join.second)});
+            }
+        }
+        joined.clear();
+        mtx.unlock();
+
+        expire_waiters();
+
+        // done backing off, back in line with everything else
+        auto now = std::chrono::steady_clock::now();
+        while (!backoff.empty() && backoff.begin()->first <= now) {
+            incoming.push_back(backoff.begin()->second);
+            backoff.erase(backoff.begin());
+        }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        for (auto transfer : incoming) {
+            HostQueue &host = hosts[transfer->host];
+            int priority = transfer->options.priority;
+
+            // right after the caller's previous one, but not ahead of whoever's turn it is now
+            unsigned long &next_turn = host.next_turn[std::make_pair(priority, transfer->options.caller)];
+            unsigned long turn = std::max(next_turn, host.turn[priority]);
+            next_turn = turn + 1;
+
+            host.pending[std::make_tuple(-priority, turn, transfer->seq)] = transfer;
+        }
+
+        for (auto &join : joins) {
+            merge(join.first, join.second);
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi, &msgs_left)) != nullptr) {
+            if (msg->msg == CURLMSG_DONE) {
+                finish(msg->easy_handle, msg->data.result);
+            }
+        }
+
+        // newly added handles make curl_multi_poll return right away, so they get going
+        // on the next round without waiting for the poll timeout
+        long token_wait_ms = admit();
+        hedge();
+
+        long timeout_ms = poll_timeout_ms();
+        if (token_wait_ms >= 0) {
+            timeout_ms = std::min(timeout_ms, token_wait_ms);
+        }
+
+        curl_multi_poll(multi, nullptr, 0, timeout_ms, nullptr);
     }
 
-    job.join();
+    // abort whatever is left, nobody is going to drive them anymore
+    mtx.lock();
+    std::deque<Transfer *> leftover;
+    leftover.swap(queue);
+    mtx.unlock();
+
+    for (auto &host_pos : hosts) {
+        for (auto &pending_pos : host_pos.second.pending) {
+            leftover.push_back(pending_pos.second);
+        }
+        host_pos.second.pending.clear();
+    }
+
+    for (auto &backoff_pos : backoff) {
+        leftover.push_back(backoff_pos.second);
+    }
+    backoff.clear();
+
+    std::set<Transfer *> running;
+    for (auto attempt : active) {
+        running.insert(attempt->transfer);
+    }
+    for (auto transfer : running) {
+        while (!transfer->attempts.empty()) {
+            release(transfer->attempts.back());
+        }
+        leftover.push_back(transfer);
+    }
+
+    for (auto transfer : leftover) {
+        complete(transfer, Buffer(), std::make_exception_ptr(std::runtime_error("HTTP client is shutting down")));
+    }
+}
+
+static std::mutex transport_mtx;
+
+static std::shared_ptr<fetch::Transport> &current_transport() {
+    static std::shared_ptr<fetch::Transport> current = fetch::transport_from_env();
+    return current;
+}
+
+std::shared_ptr<fetch::Transport> fetch::transport() {
+    transport_mtx.lock();
+    std::shared_ptr<Transport> current = current_transport();
+    transport_mtx.unlock();
+
+    return current;
+}
+
+void fetch::set_transport(std::shared_ptr<Transport> transport) {
+    transport_mtx.lock();
+    current_transport() = std::move(transport);
+    transport_mtx.unlock();
+}
+
+void fetch::configure(Config config) {
+    Client::global().configure(config);
+}
+
+std::string fetch::get(std::string url, std::list<std::string> headers) {
+    return submit_async(*transport(), url, headers).get().str();
+}
+
+std::string fetch::get(std::string url, Options options) {
+    return submit_async(*transport(), url, options).get().str();
+}
+
+std::future<fetch::Buffer> fetch::get_async(std::string url, Options options) {
+    return submit_async(*transport(), url, options);
+}
+
+// a caller of its own for every batch, see Options::caller
+static void batch_caller(fetch::Options &options) {
+    static std::atomic<unsigned long> batches{0};
+    if (options.caller.empty()) {
+        options.caller = "batch:" + std::to_string(batches++);
+    }
+}
+
+std::vector<std::future<fetch::Buffer>> fetch::get_many(const std::vector<std::string> &urls, Options options) {
+    std::shared_ptr<Transport> current = transport();
+    batch_caller(options);
+
+    std::vector<std::future<fetch::Buffer>> futures;
+    futures.reserve(urls.size());
+
+    for (auto &url : urls) {
+        futures.push_back(submit_async(*current, url, options));
+    }
+
+    return futures;
+}
+
+void fetch::get_many(const std::vector<std::string> &urls, Options options, Callback on_complete) {
+    std::shared_ptr<Transport> current = transport();
+    batch_caller(options);
 
-    if (runtime_error != "") {
-        throw std::runtime_error(runtime_error);
+    for (auto &url : urls) {
+        current->submit(url, options, on_complete);
     }
+}
 
-    return response.str();
+fetch::Stats fetch::stats() {
+    return transport()->stats();
 }
\ No newline at end of file
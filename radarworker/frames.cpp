@@ -0,0 +1,88 @@
+#include <radarworker/frames.hpp>
+
+std::string radar::FrameCache::Stats::report() const {
+    return "frames hits=" + std::to_string(hits) + " misses=" + std::to_string(misses) +
+           " evictions=" + std::to_string(evictions) + " frames=" + std::to_string(frames) +
+           " bytes=" + std::to_string(bytes) + "\n";
+}
+
+cv::Mat radar::decode_frame(const fetch::Buffer &content) {
+    if (content.empty())
+        return cv::Mat();
+
+    // header only, the decoder reads the bytes in place
+    cv::Mat buffer(1, static_cast<int>(content.size()), CV_8UC1, const_cast<uchar *>(content.data()));
+    try {
+        return cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
+    } catch (cv::Exception &e) {
+        return cv::Mat();
+    }
+}
+
+radar::FrameCache &radar::FrameCache::global() {
+    static FrameCache cache;
+    return cache;
+}
+
+cv::Mat radar::FrameCache::get(const std::string &code, std::chrono::system_clock::time_point time) {
+    cv::Mat image;
+
+    mtx.lock();
+    auto index_pos = index.find(Key(code, time));
+    if (index_pos != index.end()) {
+        frames.splice(frames.begin(), frames, index_pos->second);
+        image = index_pos->second->image;
+        counters.hits++;
+    } else {
+        counters.misses++;
+    }
+    mtx.unlock();
+
+    return image;
+}
+
+void radar::FrameCache::put(const std::string &code, std::chrono::system_clock::time_point time, cv::Mat frame) {
+    size_t bytes = frame.total() * frame.elemSize();
+    Key key(code, time);
+
+    mtx.lock();
+    // it would only push everything else out and then itself
+    if (frame.empty() || bytes > max_bytes) {
+        mtx.unlock();
+        return;
+    }
+
+    auto index_pos = index.find(key);
+    if (index_pos != index.end()) {
+        // a concurrent render decoded the same frame, keep the one that's already shared
+        frames.splice(frames.begin(), frames, index_pos->second);
+        mtx.unlock();
+        return;
+    }
+
+    frames.push_front({key, frame, bytes});
+    index[key] = frames.begin();
+    counters.bytes += bytes;
+    counters.frames++;
+    evict();
+    mtx.unlock();
+}
+
+void radar::FrameCache::evict() {
+    while (counters.bytes > max_bytes && !frames.empty()) {
+        Frame &oldest = frames.back();
+        counters.bytes -= oldest.bytes;
+        counters.frames--;
+        counters.evictions++;
+        index.erase(oldest.key);
+        frames.pop_back();
+    }
+}
+
+radar::FrameCache::Stats radar::FrameCache::stats() {
+    mtx.lock();
+    Stats copy = counters;
+    mtx.unlock();
+
+    return copy;
+}
@@ -3,7 +3,9 @@
 #include <opencv2/opencv.hpp>
 #include <tuple>
 
+#include <radarworker/frames.hpp>
 #include <radarworker/map.hpp>
+#include <radarworker/ownership.hpp>
 
 int main(int argc, char **argv) {
     std::string desc = "Usage: app place name";
@@ -34,5 +36,9 @@ int main(int argc, char **argv) {
     fileb.write(b.c_str(), b.size());
     fileb.close();
 
+    std::cout << fetch::stats().report();
+    std::cout << radar::FrameCache::global().stats().report();
+    std::cout << radar::OwnershipCache::global().stats().report();
+
     return 0;
 }
\ No newline at end of file
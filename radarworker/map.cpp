@@ -12,7 +12,6 @@
 #include <radarworker/png.hpp>
 #include <radarworker/radar.hpp>
 #include <sstream>
-#include <thread>
 #include <vector>
 
 namespace fs = boost::filesystem;
@@ -40,28 +39,43 @@ cv::Mat map::Tiles::render() {
     int rows = range_south_approx - range_north_approx;
     int cols = range_east_approx - range_west_approx;
 
-    std::vector<std::string> tiles_images(rows * cols, std::string());
+    std::vector<fetch::Buffer> tiles_images(rows * cols);
 
     fs::path usr_tempdir = fs::current_path() / ".cache";
     fs::create_directories(usr_tempdir);
 
-    std::vector<std::thread> jobs;
-    std::mutex mtx;
-    std::string runtime_error;
+    std::vector<std::string> urls;
+    std::vector<int> url_positions;
 
-    for (int tiles_y = range_north_approx, dl_count = 0; tiles_y < range_south_approx; tiles_y++) {
-        for (int tiles_x = range_west_approx; tiles_x < range_east_approx; tiles_x++, dl_count++) {
-            std::thread job([this, &tiles_images, tiles_x, tiles_y, usr_tempdir, dl_count, &mtx, &runtime_error] {
-                this->download_each(&tiles_images, tiles_x, tiles_y, usr_tempdir, dl_count, mtx, runtime_error);
-            });
+    for (int tiles_y = range_north_approx, pos = 0; tiles_y < range_south_approx; tiles_y++) {
+        for (int tiles_x = range_west_approx; tiles_x < range_east_approx; tiles_x++, pos++) {
+            std::string url = tile_url(tiles_x, tiles_y);
+            if (read_cached_tile(url, usr_tempdir, tiles_images.at(pos)))
+                continue;
 
-            jobs.push_back(std::move(job));
+            urls.push_back(url);
+            url_positions.push_back(pos);
         }
     }
 
-    for (auto &job : jobs) {
-        if (job.joinable()) {
-            job.join();
+    fetch::Options options(tile_headers());
+    options.deadline = deadline;
+    // every tile comes from the same host, so they can share one HTTP/2 connection
+    options.multiplex = true;
+    // a big map shouldn't hold up everyone else's geocoding and radar requests
+    options.priority = -1;
+    options.site = "tile";
+
+    auto downloads = fetch::get_many(urls, options);
+    std::string runtime_error;
+
+    for (int i = 0; i < downloads.size(); i++) {
+        try {
+            fetch::Buffer data = downloads.at(i).get();
+            write_cached_tile(urls.at(i), usr_tempdir, data);
+            tiles_images.at(url_positions.at(i)) = data;
+        } catch (std::runtime_error &e) {
+            runtime_error = e.what();
         }
     }
 
@@ -70,7 +84,7 @@ cv::Mat map::Tiles::render() {
     }
 
     // get resolution of the first one as a reference
-    auto resolution = png::get_resolution(tiles_images.at(0));
+    auto resolution = png::get_resolution(tiles_images.at(0).data(), tiles_images.at(0).size());
     int width = resolution[0], height = resolution[1];
 
     int uncropped_canvas_width = width * cols, uncropped_canvas_height = height * rows;
@@ -79,8 +93,8 @@ cv::Mat map::Tiles::render() {
 
     for (int row = 0, count = 0; row < rows; row++) {
         for (int col = 0; col < cols; col++, count++) {
-            std::string current = tiles_images.at(count);
-            std::vector<uchar> buffer(current.begin(), current.end());
+            fetch::Buffer &current = tiles_images.at(count);
+            cv::Mat buffer(1, static_cast<int>(current.size()), CV_8UC1, const_cast<uchar *>(current.data()));
 
             cv::Mat tiles_image = cv::imdecode(buffer, cv::IMREAD_COLOR);
             cv::Mat inset(uncropped_canvas, cv::Rect(width * col, height * row, width, height));
@@ -115,58 +129,59 @@ cv::Mat map::Tiles::render() {
     return cropped_canvas_alpha;
 }
 
-void map::Tiles::download_each(std::vector<std::string> *tiles_images, int tiles_x, int tiles_y, fs::path usr_tempdir, int pos,
-    std::mutex &mtx, std::string &runtime_error) {
+std::string map::Tiles::tile_url(int tiles_x, int tiles_y) {
+    return OSM_TILES_BASE_URL + std::to_string(zoom_level) + "/" + std::to_string(tiles_x) + "/" + std::to_string(tiles_y) +
+        ".png";
+}
 
-    std::string URL_SCHEME = OSM_TILES_BASE_URL + std::to_string(zoom_level) + "/" + std::to_string(tiles_x) + "/" +
-        std::to_string(tiles_y) + ".png";
+std::list<std::string> map::Tiles::tile_headers() {
+    std::list<std::string> headers;
+    headers.push_back("User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+                      "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/123.0.0.0 "
+                      "Safari/537.36");
+    headers.push_back("Referer: https://www.openstreetmap.org/");
+    headers.push_back("Accept: "
+                      "image/avif,image/webp,image/apng, text/html,image/svg+xml,image/*,*/*;q=0.8");
+    headers.push_back("Sec-Ch-Ua: \"Google Chrome\";v=\"123\", \"Not:A-Brand\";v=\"8\", "
+                      "\"Chromium\";v=\"123\"");
+
+    return headers;
+}
 
+static fs::path tile_cache_path(const std::string &url, const fs::path &usr_tempdir) {
     std::hash<std::string> hasher;
-    size_t hash_value = hasher(URL_SCHEME);
+    size_t hash_value = hasher(url);
 
     std::stringstream ss;
     ss << std::hex << hash_value;
 
-    fs::path PATH_SCHEME = usr_tempdir / ss.str();
-    bool cache_exists = fs::exists(PATH_SCHEME);
+    return usr_tempdir / ss.str();
+}
 
-    std::string data;
-    if (cache_exists) {
-        std::ifstream cache_file(PATH_SCHEME, std::ios::binary);
-        if (!cache_file.is_open()) {
-            goto redownload;
-        }
+bool map::Tiles::read_cached_tile(const std::string &url, const fs::path &usr_tempdir, fetch::Buffer &data) {
+    fs::path PATH_SCHEME = tile_cache_path(url, usr_tempdir);
+    if (!fs::exists(PATH_SCHEME))
+        return false;
 
-        std::vector<char> buffer(std::istreambuf_iterator<char>(cache_file), {});
-        data = std::string(buffer.begin(), buffer.end());
-
-        cache_file.close();
-    } else {
-    redownload:
-        std::list<std::string> headers;
-        headers.push_back("User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
-                          "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/123.0.0.0 "
-                          "Safari/537.36");
-        headers.push_back("Referer: https://www.openstreetmap.org/");
-        headers.push_back("Accept: "
-                          "image/avif,image/webp,image/apng, text/html,image/svg+xml,image/*,*/*;q=0.8");
-        headers.push_back("Accept-Encoding: gzip, deflate, br, zstd");
-        headers.push_back("Sec-Ch-Ua: \"Google Chrome\";v=\"123\", \"Not:A-Brand\";v=\"8\", "
-                          "\"Chromium\";v=\"123\"");
+    std::ifstream cache_file(PATH_SCHEME, std::ios::binary);
+    if (!cache_file.is_open())
+        return false;
 
-        try {
-            data = fetch::get(URL_SCHEME, headers);
-        } catch (std::runtime_error &e) {
-            runtime_error = e.what();
-        }
-        std::ofstream output_file(PATH_SCHEME, std::ios::binary);
-        output_file.write(data.c_str(), data.size());
-        output_file.close();
-    }
+    auto buffer = std::make_shared<std::vector<unsigned char>>(fs::file_size(PATH_SCHEME));
+    cache_file.read(reinterpret_cast<char *>(buffer->data()), buffer->size());
+    cache_file.close();
 
-    mtx.lock();
-    (*tiles_images).at(pos) = data;
-    mtx.unlock();
+    if (!cache_file || buffer->size() == 0)
+        return false;
+
+    data = fetch::Buffer(buffer);
+    return true;
+}
+
+void map::Tiles::write_cached_tile(const std::string &url, const fs::path &usr_tempdir, const fetch::Buffer &data) {
+    std::ofstream output_file(tile_cache_path(url, usr_tempdir), std::ios::binary);
+    output_file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    output_file.close();
 }
 
 cv::Mat map::Tiles::render_with_overlay_radar(radar::Imagery &imagery, float map_brightness, float radar_opacity) {
@@ -181,6 +196,9 @@ cv::Mat map::Tiles::render_with_overlay_radar(radar::Imagery &imagery, float map
     }
 
     imagery.set_boundaries(boundaries[0], boundaries[1], boundaries[2], boundaries[3]);
+    if (!imagery.deadline) {
+        imagery.deadline = deadline;
+    }
     cv::Mat radar_imagery = imagery.render(base_map.cols, base_map.rows);
     for (int i = 0; i < radar_imagery.rows; i++) {
         for (int j = 0; j < radar_imagery.cols; j++) {
@@ -258,11 +276,13 @@ std::array<double, 4> map::OSM_get_bounding_box(std::string place) {
     👺👺👺👺👺.push_back("Referer: https://www.openstreetmap.org/");
     👺👺👺👺👺.push_back("Accept: "
                          "application/json,text/html,image/svg+xml,image/*,*/*;q=0.8");
-    👺👺👺👺👺.push_back("Accept-Encoding: gzip, deflate, br, zstd");
     👺👺👺👺👺.push_back("Sec-Ch-Ua: \"Google Chrome\";v=\"123\", \"Not:A-Brand\";v=\"8\", "
                          "\"Chromium\";v=\"123\"");
 
-    std::string content = fetch::get(URL, 👺👺👺👺👺);
+    fetch::Options options(👺👺👺👺👺);
+    options.site = "geocode";
+
+    std::string content = fetch::get(URL, options);
     json API_data;
 
     try {
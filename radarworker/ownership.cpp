@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <radarworker/ownership.hpp>
+#include <radarworker/radar.hpp>
+
+double Qx1(double y, double x1, double x2, double y1, double y2) {
+    double numerator = -(y - y1) * (y - y1) + (y - y2) * (y - y2) - x1 * x1 + x2 * x2;
+    double denominator = 2 * (x2 - x1);
+
+    return numerator / denominator;
+}
+
+// Halfway line between C1 and C2
+double Q1(double x, double y, double x1, double x2, double y1, double y2) {
+    return (x - x1) * (x - x1) - (x - x2) * (x - x2) + (y - y1) * (y - y1) - (y - y2) * (y - y2);
+}
+
+// Area outside of C2
+double Q2(double x, double y, double x2, double y2, double r2) {
+    return -(x - x2) * (x - x2) - (y - y2) * (y - y2) + r2 * r2;
+}
+
+// Area of C1
+double Q3(double x, double y, double x1, double y1, double r1) {
+    return (x - x1) * (x - x1) + (y - y1) * (y - y1) - r1 * r1;
+}
+
+// max(Q3, min(Q1, Q2) of every overlapping radar), zero on the border of current's area
+double boundary_value(
+    const radar::PositionalData &current, const std::vector<radar::PositionalData> &radars, double x, double y) {
+    double maximum_value = Q3(x, y, current.lon, current.lat, current.range);
+    for (auto &radar : radars) {
+        double minimum = Q2(x, y, radar.lon, radar.lat, radar.range);
+        if (current.priority == radar.priority) {
+            minimum = std::min(minimum, Q1(x, y, current.lon, radar.lon, current.lat, radar.lat));
+        }
+
+        maximum_value = std::max(maximum_value, minimum);
+    }
+
+    return maximum_value;
+}
+
+std::shared_ptr<const radar::Ownership> radar::solve_ownership(const std::array<double, 4> &boundaries, int width,
+    int height, const PositionalData &current, const std::vector<PositionalData> &overlapping_radars) {
+    // https://www.desmos.com/calculator/lgmzgbhlxd
+
+    auto ownership = std::make_shared<Ownership>();
+    ownership->row_offsets.reserve(height + 1);
+    ownership->row_offsets.push_back(0);
+
+    // reused for every row
+    std::vector<double> x_to_check;
+    std::vector<int> x_boundaries;
+    for (int y = 0; y < height; y++) {
+        double cen_y = y + 0.5;
+        double lat = boundaries[0] - (boundaries[0] - boundaries[2]) * cen_y / height;
+        x_to_check.clear();
+
+        double determinant = current.range * current.range - (lat - current.lat) * (lat - current.lat);
+        if (determinant < 0) {
+            ownership->row_offsets.push_back(ownership->spans.size());
+            continue;
+        }
+
+        double Qx3right = sqrt(determinant);
+        x_to_check.push_back(current.lon + Qx3right);
+        x_to_check.push_back(current.lon - Qx3right);
+
+        for (auto &pos_data : overlapping_radars) {
+            double Qx1Result = Qx1(lat, current.lon, pos_data.lon, current.lat, pos_data.lat);
+            // imagine if it goes to almost infinity, not a fun calculation
+            // it's just a safeguard (not really but yeah)
+            if (std::abs(Qx1Result - current.lon) <= current.range && current.priority == pos_data.priority) {
+                x_to_check.push_back(Qx1Result);
+            }
+
+            double Qx2det = pos_data.range * pos_data.range - (lat - pos_data.lat) * (lat - pos_data.lat);
+            if (pos_data.use_Qx2 && Qx2det >= 0) {
+                double Qx2right = sqrt(Qx2det);
+                x_to_check.push_back(pos_data.lon + Qx2right);
+                x_to_check.push_back(pos_data.lon - Qx2right);
+            }
+        }
+
+        x_boundaries.clear();
+        for (auto x : x_to_check) {
+            double maximum_value = boundary_value(current, overlapping_radars, x, lat);
+
+            // if it equals zero, then yes that IS the boundary
+            if (std::abs(maximum_value) < EPSILON) {
+                double bound = width * (x - boundaries[1]) / (boundaries[3] - boundaries[1]);
+                x_boundaries.push_back(static_cast<int>(floor(bound)));
+            }
+        }
+
+        std::sort(x_boundaries.begin(), x_boundaries.end());
+        // x_boundaries will ALWAYS have an even length, FYI. a stray one on a row that was never drawn
+        // before shouldn't take the whole render down though
+        for (int i = 0; i + 1 < x_boundaries.size(); i += 2) {
+            ownership->spans.push_back(x_boundaries.at(i));
+            ownership->spans.push_back(x_boundaries.at(i + 1));
+        }
+        ownership->row_offsets.push_back(ownership->spans.size());
+    }
+
+    return ownership;
+}
+
+std::vector<radar::PositionalData> radar::rivals_of(
+    const PositionalData &current, const std::vector<PositionalData> &neighbours) {
+    std::vector<PositionalData> rivals;
+    for (auto &neighbour : neighbours) {
+        double dist_x = (neighbour.lon - current.lon);
+        double dist_y = (neighbour.lat - current.lat);
+        double dist = sqrt(dist_x * dist_x + dist_y * dist_y);
+
+        if (current.priority > neighbour.priority) {
+            continue;
+        }
+
+        if (dist < current.range + neighbour.range) {
+            PositionalData rival = neighbour;
+            rival.use_Qx2 = neighbour.range < current.range;
+            rivals.push_back(rival);
+        }
+    }
+
+    return rivals;
+}
+
+std::vector<int> radar::label_coverage(
+    const std::array<double, 4> &boundaries, int width, int height, const std::vector<PositionalData> &radars) {
+    std::vector<int> labels(static_cast<size_t>(width) * height, -1);
+    double px_width = (boundaries[3] - boundaries[1]) / width;
+
+    // a pixel goes to the lowest distance squared minus priority times this, which is more than any
+    // distance squared inside a circle. one number to compare instead of two
+    double priority_step = 1;
+    for (auto &radar : radars) {
+        priority_step = std::max(priority_step, 2 * radar.range * radar.range);
+    }
+
+    // of the best radar so far of every pixel of the row
+    std::vector<double> best_rank(width);
+    // longitude of every pixel's center, same for every row
+    std::vector<double> lons(width);
+    for (int x = 0; x < width; x++) {
+        lons.at(x) = boundaries[1] + (x + 0.5) * px_width;
+    }
+
+    for (int y = 0; y < height; y++) {
+        double lat = boundaries[0] - (boundaries[0] - boundaries[2]) * (y + 0.5) / height;
+        int *row = labels.data() + static_cast<size_t>(y) * width;
+        std::fill(best_rank.begin(), best_rank.end(), std::numeric_limits<double>::infinity());
+
+        for (int r = 0; r < radars.size(); r++) {
+            const PositionalData &radar = radars[r];
+            double dist_y = lat - radar.lat;
+            double determinant = radar.range * radar.range - dist_y * dist_y;
+            if (determinant < 0) {
+                continue;
+            }
+
+            // only the pixels whose center is inside the circle on this row
+            double half = sqrt(determinant);
+            int first = std::max(0, static_cast<int>(ceil((radar.lon - half - boundaries[1]) / px_width - 0.5)));
+            int last = std::min(width - 1, static_cast<int>(floor((radar.lon + half - boundaries[1]) / px_width - 0.5)));
+
+            // no branches and nothing but plain arrays, so the compiler does a few pixels per instruction
+            const double *lon = lons.data();
+            double *best = best_rank.data();
+            double radar_lon = radar.lon;
+            double offset = dist_y * dist_y - radar.priority * priority_step;
+            for (int x = first; x <= last; x++) {
+                double dist_x = lon[x] - radar_lon;
+                double rank = dist_x * dist_x + offset;
+                int label = row[x];
+                double best_so_far = best[x];
+                row[x] = rank < best_so_far ? r : label;
+                best[x] = std::min(rank, best_so_far);
+            }
+        }
+    }
+
+    return labels;
+}
+
+std::vector<std::shared_ptr<const radar::Ownership>> radar::ownership_of_labels(
+    const std::vector<int> &labels, int width, int height, int count) {
+    std::vector<std::shared_ptr<Ownership>> ownerships;
+    for (int r = 0; r < count; r++) {
+        ownerships.push_back(std::make_shared<Ownership>());
+        ownerships.back()->row_offsets.reserve(height + 1);
+        ownerships.back()->row_offsets.push_back(0);
+    }
+
+    for (int y = 0; y < height; y++) {
+        const int *row = labels.data() + static_cast<size_t>(y) * width;
+        int start = 0;
+        for (int x = 1; x <= width; x++) {
+            if (x < width && row[x] == row[start])
+                continue;
+
+            if (row[start] >= 0) {
+                ownerships.at(row[start])->spans.push_back(start);
+                ownerships.at(row[start])->spans.push_back(x);
+            }
+            start = x;
+        }
+
+        for (auto &ownership : ownerships) {
+            ownership->row_offsets.push_back(ownership->spans.size());
+        }
+    }
+
+    return std::vector<std::shared_ptr<const Ownership>>(ownerships.begin(), ownerships.end());
+}
+
+std::string radar::OwnershipCache::Stats::report() const {
+    return "ownership hits=" + std::to_string(hits) + " misses=" + std::to_string(misses) +
+           " evictions=" + std::to_string(evictions) + " entries=" + std::to_string(entries) +
+           " bytes=" + std::to_string(bytes) + "\n";
+}
+
+radar::OwnershipCache &radar::OwnershipCache::global() {
+    static OwnershipCache cache;
+    return cache;
+}
+
+std::shared_ptr<const radar::Ownership> radar::OwnershipCache::get(const std::vector<double> &key) {
+    std::shared_ptr<const Ownership> ownership;
+
+    mtx.lock();
+    auto index_pos = index.find(key);
+    if (index_pos != index.end()) {
+        entries.splice(entries.begin(), entries, index_pos->second);
+        ownership = index_pos->second->ownership;
+        counters.hits++;
+    } else {
+        counters.misses++;
+    }
+    mtx.unlock();
+
+    return ownership;
+}
+
+void radar::OwnershipCache::put(const std::vector<double> &key, std::shared_ptr<const Ownership> ownership) {
+    size_t bytes = (ownership->row_offsets.size() + ownership->spans.size()) * sizeof(int) + key.size() * sizeof(double);
+
+    mtx.lock();
+    if (bytes > max_bytes || index.find(key) != index.end()) {
+        mtx.unlock();
+        return;
+    }
+
+    entries.push_front({key, std::move(ownership), bytes});
+    index[key] = entries.begin();
+    counters.bytes += bytes;
+    counters.entries++;
+    evict();
+    mtx.unlock();
+}
+
+void radar::OwnershipCache::evict() {
+    while (counters.bytes > max_bytes && !entries.empty()) {
+        Entry &oldest = entries.back();
+        counters.bytes -= oldest.bytes;
+        counters.entries--;
+        counters.evictions++;
+        index.erase(oldest.key);
+        entries.pop_back();
+    }
+}
+
+radar::OwnershipCache::Stats radar::OwnershipCache::stats() {
+    mtx.lock();
+    Stats copy = counters;
+    mtx.unlock();
+
+    return copy;
+}
@@ -1,6 +1,7 @@
 #include <bitset>
 #include <iostream>
 #include <radarworker/png.hpp>
+#include <stdexcept>
 #include <string>
 
 std::array<unsigned int, 2> png::get_resolution(std::string &data) {
@@ -17,5 +18,22 @@ std::array<unsigned int, 2> png::get_resolution(std::string &data) {
         height |= static_cast<u_char>(height_part[pos]) << (shift * 8);
     }
 
+    return std::array<unsigned int, 2>{width, height};
+}
+
+std::array<unsigned int, 2> png::get_resolution(const unsigned char *data, size_t size) {
+    // 8 bytes signature, then the IHDR chunk length and type, then width and height
+    if (size < 24) {
+        throw std::runtime_error("PNG data too short");
+    }
+
+    unsigned int width = 0;
+    unsigned int height = 0;
+
+    for (int pos = 0, shift = 3; pos < 4; pos++, shift--) {
+        width |= static_cast<unsigned int>(data[16 + pos]) << (shift * 8);
+        height |= static_cast<unsigned int>(data[20 + pos]) << (shift * 8);
+    }
+
     return std::array<unsigned int, 2>{width, height};
 }
\ No newline at end of file
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <radarworker/catalog.hpp>
+#include <radarworker/frames.hpp>
+#include <radarworker/prefetch.hpp>
+#include <radarworker/store.hpp>
+
+std::chrono::seconds radar::publication_interval(const RadarImage &detail) {
+    auto &time = detail.data.time;
+
+    std::vector<long> gaps;
+    for (size_t i = 1; i < time.size(); i++) {
+        long gap = std::chrono::duration_cast<std::chrono::seconds>(time.at(i) - time.at(i - 1)).count();
+        if (gap > 0) {
+            gaps.push_back(gap);
+        }
+    }
+
+    if (gaps.empty())
+        return std::chrono::seconds(0);
+
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    return std::chrono::seconds(gaps.at(gaps.size() / 2));
+}
+
+radar::Prefetcher &radar::Prefetcher::global() {
+    // the catalog, and the fetch client and store with it, has to outlive the worker. so does the frame cache
+    RadarCatalog::global();
+    FrameCache::global();
+
+    static Prefetcher prefetcher;
+    return prefetcher;
+}
+
+radar::Prefetcher::~Prefetcher() {
+    stop();
+}
+
+void radar::Prefetcher::start() {
+    mtx.lock();
+    if (!worker.joinable()) {
+        stopping = false;
+        worker = std::thread([this] { this->run(); });
+    }
+    mtx.unlock();
+}
+
+void radar::Prefetcher::stop() {
+    mtx.lock();
+    stopping = true;
+    if (polling) {
+        polling->cancel();
+    }
+    mtx.unlock();
+
+    wakeup.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+// called with mtx held
+void radar::Prefetcher::schedule(Station &station, const RadarImage &detail, bool is_new) {
+    auto now = std::chrono::system_clock::now();
+
+    if (is_new) {
+        std::chrono::seconds interval = publication_interval(detail);
+        station.interval = interval.count() > 0 ? interval : default_interval;
+        station.latest = detail.data.time.back();
+    }
+
+    auto expected = station.latest + station.interval + publish_delay;
+    if (expected > now) {
+        station.next_poll = expected;
+    } else if (now - station.latest > station.interval * 3) {
+        // been quiet for a while, probably down. no point asking every retry_interval
+        station.next_poll = now + station.interval;
+    } else {
+        station.next_poll = now + retry_interval;
+    }
+}
+
+void radar::Prefetcher::run() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (!stopping) {
+        polling = std::make_shared<fetch::Deadline>(poll_timeout);
+        std::shared_ptr<fetch::Deadline> deadline = polling;
+        lock.unlock();
+
+        std::shared_ptr<const RadarCatalog::Snapshot> catalog;
+        try {
+            catalog = RadarCatalog::global().snapshot(deadline);
+        } catch (std::runtime_error &e) {
+            if (!deadline->is_cancelled()) {
+                log_error(std::string("Prefetch couldn't get the radar catalog: ") + e.what());
+            }
+        }
+
+        // stations we haven't seen yet, and frames the catalog found before we did
+        std::vector<RadarImage> newer;
+        std::vector<std::string> due;
+
+        lock.lock();
+        if (catalog) {
+            for (auto &detail_pos : catalog->details) {
+                const RadarImage &detail = *detail_pos.second;
+                Station &station = stations[detail_pos.first];
+                if (detail.data.time.back() > station.latest) {
+                    schedule(station, detail, true);
+                    newer.push_back(detail);
+                }
+            }
+        }
+
+        auto now = std::chrono::system_clock::now();
+        for (auto &station_pos : stations) {
+            if (station_pos.second.next_poll <= now) {
+                due.push_back(station_pos.first);
+            }
+        }
+        lock.unlock();
+
+        warm(newer, deadline);
+        if (!due.empty()) {
+            poll(due, deadline);
+        }
+
+        lock.lock();
+        polling = nullptr;
+
+        auto until = std::chrono::system_clock::now() + retry_interval;
+        for (auto &station_pos : stations) {
+            until = std::min(until, station_pos.second.next_poll);
+        }
+        wakeup.wait_until(lock, until);
+    }
+}
+
+void radar::Prefetcher::poll(const std::vector<std::string> &codes, std::shared_ptr<fetch::Deadline> deadline) {
+    std::vector<std::string> urls;
+    for (auto &code : codes) {
+        urls.push_back(detailed_data_url(code));
+    }
+
+    fetch::Options options;
+    options.deadline = deadline;
+    // someone waiting on a render goes first
+    options.priority = -1;
+    options.retries = 2;
+    options.site = "prefetch";
+
+    auto downloads = fetch::get_many(urls, options);
+    std::vector<RadarImage> newer;
+
+    for (int i = 0; i < downloads.size(); i++) {
+        RadarImage detail;
+        fetch::Buffer content;
+        bool has_data = false;
+        try {
+            content = downloads.at(i).get();
+            has_data = parse_radar_detail(content, detail);
+        } catch (std::runtime_error &e) {
+            if (!deadline->is_cancelled()) {
+                log_error("Prefetch of " + codes.at(i) + "'s detail failed: " + e.what());
+            }
+        }
+
+        mtx.lock();
+        Station &station = stations[codes.at(i)];
+        bool is_new = has_data && detail.data.time.back() > station.latest;
+        schedule(station, detail, is_new);
+        mtx.unlock();
+
+        if (is_new) {
+            RadarCatalog::global().update(detail);
+            FrameStore::global().write_detail(detail.kode, content);
+            newer.push_back(detail);
+        }
+    }
+
+    warm(newer, deadline);
+}
+
+void radar::Prefetcher::warm(const std::vector<RadarImage> &radars, std::shared_ptr<fetch::Deadline> deadline) {
+    if (radars.empty())
+        return;
+
+    FrameStore &store = FrameStore::global();
+    FrameCache &frame_cache = FrameCache::global();
+
+    // right after a restart most of these are still on disk. one that doesn't decode is as good as missing
+    std::vector<int> fetched;
+    std::vector<std::string> urls;
+    for (int i = 0; i < radars.size(); i++) {
+        const RadarImage &radar = radars.at(i);
+        fetch::Buffer content;
+        if (store.read_frame(radar.kode, radar.data.time.back(), content)) {
+            cv::Mat image = decode_frame(content);
+            if (!image.empty()) {
+                frame_cache.put(radar.kode, radar.data.time.back(), image);
+                continue;
+            }
+            store.remove_frame(radar.kode, radar.data.time.back());
+        }
+
+        fetched.push_back(i);
+        urls.push_back(radar.data.file.back());
+    }
+
+    fetch::Options options;
+    options.deadline = deadline;
+    options.priority = -1;
+    options.retries = 2;
+    options.fail_on_error = true;
+    options.site = "prefetch";
+
+    auto downloads = fetch::get_many(urls, options);
+    for (int j = 0; j < downloads.size(); j++) {
+        const RadarImage &radar = radars.at(fetched.at(j));
+        try {
+            fetch::Buffer content = downloads.at(j).get();
+            cv::Mat image = decode_frame(content);
+            if (image.empty()) {
+                log_error("Prefetched frame of " + radar.kode + " didn't decode (" + urls.at(j) + ")");
+                continue;
+            }
+
+            // only what decodes is kept, renders never see anything else
+            store.write_frame(radar.kode, radar.data.time.back(), content);
+            frame_cache.put(radar.kode, radar.data.time.back(), image);
+        } catch (std::runtime_error &e) {
+            if (!deadline->is_cancelled()) {
+                log_error("Prefetch of " + radar.kode + "'s frame failed: " + e.what());
+            }
+        }
+    }
+}
@@ -1,17 +1,17 @@
 #include <cmath>
-#include <curlpp/Easy.hpp>
-#include <curlpp/Options.hpp>
-#include <curlpp/cURLpp.hpp>
-#include <date/date.h>
+#include <cstdlib>
 #include <iostream>
-#include <nlohmann/json.hpp>
 #include <radar_debug/debug.h>
+#include <radarworker/catalog.hpp>
 #include <radarworker/fetch.hpp>
+#include <radarworker/frames.hpp>
+#include <radarworker/ownership.hpp>
 #include <radarworker/radar.hpp>
+#include <radarworker/store.hpp>
+#include <future>
+#include <set>
 #include <thread>
 
-using json = nlohmann::json;
-
 bool radar::is_overlapping(std::array<double, 4> x, std::array<double, 4> y) {
     double &latx1 = x[2];
     double &latx2 = x[0];
@@ -29,65 +29,55 @@ bool radar::is_overlapping(std::array<double, 4> x, std::array<double, 4> y) {
     return lat_overlap && lon_overlap;
 }
 
-struct PositionalData {
-    radar::RadarImage data;
-    double range;
-    int priority;
-    bool use_Qx2;
-};
-
-double Qx1(double y, double x1, double x2, double y1, double y2) {
-    double numerator = -(y - y1) * (y - y1) + (y - y2) * (y - y2) - x1 * x1 + x2 * x2;
-    double denominator = 2 * (x2 - x1);
-
-    return numerator / denominator;
-}
-
-// Halfway line between C1 and C2
-double Q1(double x, double y, double x1, double x2, double y1, double y2) {
-    return (x - x1) * (x - x1) - (x - x2) * (x - x2) + (y - y1) * (y - y1) - (y - y2) * (y - y2);
-}
-
-// Area outside of C2
-double Q2(double x, double y, double x2, double y2, double r2) {
-    return -(x - x2) * (x - x2) - (y - y2) * (y - y2) + r2 * r2;
+radar::CircuitBreaker &radar::CircuitBreaker::global() {
+    static CircuitBreaker breaker;
+    return breaker;
 }
 
-// Area of C1
-double Q3(double x, double y, double x1, double y1, double r1) {
-    return (x - x1) * (x - x1) + (y - y1) * (y - y1) - r1 * r1;
-}
-
-std::vector<double> min_Q1_Q2(PositionalData current, std::vector<PositionalData> radars, double x, double y) {
-    std::vector<double> result;
-    for (auto radar : radars) {
-        double minimum = Q2(x, y, radar.data.lon, radar.data.lat, radar.range);
-        if (current.priority == radar.priority) {
-            minimum = std::min(minimum, Q1(x, y, current.data.lon, radar.data.lon, current.data.lat, radar.data.lat));
-        }
+bool radar::CircuitBreaker::allow(const std::string &key) {
+    auto now = std::chrono::steady_clock::now();
 
-        result.push_back(minimum);
+    mtx.lock();
+    Breaker &breaker = breakers[key];
+    bool allowed = breaker.state == State::CLOSED;
+
+    // a probe that never reported back doesn't keep it half open forever
+    if (breaker.state != State::CLOSED && now - breaker.since >= cool_down) {
+        breaker.state = State::HALF_OPEN;
+        breaker.since = now;
+        allowed = true;
     }
+    mtx.unlock();
 
-    return result;
+    return allowed;
 }
 
-void radar::Imagery::render_loop(int width, int height, std::vector<radar::RadarImage> &radars,
-    std::vector<std::string> &raw_images, cv::Mat &container, int i, std::mutex &mtx, bool *is_done) {
-
+void radar::CircuitBreaker::record_success(const std::string &key) {
     mtx.lock();
-    radar::RadarImage d = radars.at(i);
-    std::string img_content = raw_images.at(i);
+    Breaker &breaker = breakers[key];
+    breaker.state = State::CLOSED;
+    breaker.failures = 0;
     mtx.unlock();
+}
 
-    std::vector<uchar> buffer(img_content.begin(), img_content.end());
-    cv::Mat image;
-    try {
-        image = cv::imdecode(buffer, cv::IMREAD_UNCHANGED);
-    } catch (cv::Exception &e) {
-        std::string err = e.what();
-        throw std::runtime_error("OpenCV error: " + err);
+void radar::CircuitBreaker::record_failure(const std::string &key) {
+    mtx.lock();
+    Breaker &breaker = breakers[key];
+    breaker.failures++;
+    if (breaker.state == State::HALF_OPEN || breaker.failures >= failure_threshold) {
+        breaker.state = State::OPEN;
+        breaker.since = std::chrono::steady_clock::now();
     }
+    mtx.unlock();
+}
+
+// radars and frames don't change while the jobs run, so they're read without
+// the lock. it only guards the container and used_radars
+void radar::Imagery::render_loop(int width, int height, const std::vector<std::shared_ptr<const RadarImage>> &radars,
+    const std::vector<cv::Mat> &frames, cv::Mat &container, int i, std::mutex &mtx, bool *is_done) {
+
+    const radar::RadarImage &d = *radars.at(i);
+    cv::Mat image = frames.at(i);
 
     int radar_width = image.cols, radar_height = image.rows;
 
@@ -116,7 +106,8 @@ void radar::Imagery::render_loop(int width, int height, std::vector<radar::Radar
 
     // crop the image, not creating a copy
     cv::Mat image_crop = image(cv::Rect(image_cropleft_floor, image_croptop_floor, image_cropwidth, image_cropheight));
-    image_crop.copyTo(image);
+    // but from here on it gets drawn on, and a prefetched frame is shared with the cache
+    image = image_crop.clone();
 
     std::array<double, 4> image_cropbounds = {
         d.boundaries[0] - (d.boundaries[0] - d.boundaries[2]) * image_croptop / radar_height,
@@ -180,9 +171,7 @@ void radar::Imagery::render_loop(int width, int height, std::vector<radar::Radar
     const int STRIPE_EVERY_PX = 2;
     cv::Mat empty_mask = cv::Mat::zeros(STRIPE_EVERY_PX, roi_width, CV_8UC4);
 
-    auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(d.data.time.back());
-
-    if (seconds_to_now > (declare_old_after_mins * 60) && stripe_on_old_radars) {
+    if (geometry.stale.at(i) && stripe_on_old_radars) {
         for (int y = 0; y < roi_height; y += STRIPE_EVERY_PX * 2) {
             int current_height = std::min(STRIPE_EVERY_PX, roi_height - y);
             cv::Mat empty_mask_roi = empty_mask(cv::Rect(0, 0, roi_width, current_height));
@@ -193,191 +182,172 @@ void radar::Imagery::render_loop(int width, int height, std::vector<radar::Radar
 
     bool radar_used_atleast_once = false;
 
-    std::vector<PositionalData> overlapping_radars;
-    double current_range = DEFAULT_RANGE;
-    int current_priority = 0;
-
-    mtx.lock();
-    auto current_range_pos = radarRangeOverride.find(d.kode);
-    if (current_range_pos != radarRangeOverride.end()) {
-        current_range = current_range_pos->second;
-    }
-    auto current_priority_pos = radarPriority.find(d.kode);
-    if (current_priority_pos != radarPriority.end()) {
-        current_priority = current_priority_pos->second;
-    }
-    mtx.unlock();
-    if (seconds_to_now > (declare_old_after_mins * 60)) {
-        current_priority = -1;
+    std::shared_ptr<const Ownership> ownership;
+    if (single_pass_coverage) {
+        ownership = coverage.at(i);
+    } else {
+        ownership = solved_ownership(width, height, i);
     }
 
-    PositionalData current_positional_data = {d, current_range, current_priority};
-
-    for (int r_index = 0; r_index < radars.size(); r_index++) {
-        if (i == r_index) {
-            continue;
-        }
-        mtx.lock();
-        radar::RadarImage indexed_radar = radars.at(r_index);
-        mtx.unlock();
-        double dist_x = (indexed_radar.lon - d.lon);
-        double dist_y = (indexed_radar.lat - d.lat);
-        double dist = sqrt(dist_x * dist_x + dist_y * dist_y);
-
-        double indexed_range = DEFAULT_RANGE;
-        int indexed_priority = 0;
-        mtx.lock();
-        auto indexed_range_pos = radarRangeOverride.find(indexed_radar.kode);
-        if (indexed_range_pos != radarRangeOverride.end()) {
-            indexed_range = indexed_range_pos->second;
-        }
-
-        auto indexed_priority_pos = radarPriority.find(indexed_radar.kode);
-        if (indexed_priority_pos != radarPriority.end()) {
-            indexed_priority = indexed_priority_pos->second;
-        }
-        mtx.unlock();
-
-        auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(indexed_radar.data.time.back());
-        if (seconds_to_now > (declare_old_after_mins * 60)) {
-            indexed_priority = -1;
-        }
-
-        if (current_priority > indexed_priority) {
-            continue;
-        }
-
-        if (dist < current_range + indexed_range) {
-            bool use_Qx2 = indexed_range < current_range;
-
-            PositionalData pos_data = {indexed_radar, indexed_range, indexed_priority, use_Qx2};
-            overlapping_radars.push_back(pos_data);
-        }
-    }
-
-    // https://www.desmos.com/calculator/lgmzgbhlxd
-
-    double px_width = (boundaries[3] - boundaries[1]) / width;
     for (int y = 0; y < roi_height; y++) {
-        double cen_y = roi_y_start + y + 0.5;
-        double lat = boundaries[0] - (boundaries[0] - boundaries[2]) * cen_y / height;
-        std::vector<double> x_to_check;
-
-        double determinant = current_range * current_range - (lat - d.lat) * (lat - d.lat);
-        if (determinant < 0) {
+        int container_y = roi_y_start + y;
+        if (container_y < 0 || container_y >= height) {
             continue;
         }
 
-        double Qx3right = sqrt(determinant);
-        x_to_check.push_back(d.lon + Qx3right);
-        x_to_check.push_back(d.lon - Qx3right);
-
-        for (auto pos_data : overlapping_radars) {
-            double Qx1Result = Qx1(lat, d.lon, pos_data.data.lon, d.lat, pos_data.data.lat);
-            // imagine if it goes to almost infinity, not a fun calculation
-            // it's just a safeguard (not really but yeah)
-            if (abs(Qx1Result - d.lon) <= current_range && current_priority == pos_data.priority) {
-                x_to_check.push_back(Qx1Result);
-            }
-
-            double Qx2det = pos_data.range * pos_data.range - (lat - pos_data.data.lat) * (lat - pos_data.data.lat);
-            if (pos_data.use_Qx2 && Qx2det >= 0) {
-                double Qx2right = sqrt(Qx2det);
-                x_to_check.push_back(pos_data.data.lon + Qx2right);
-                x_to_check.push_back(pos_data.data.lon - Qx2right);
-            }
-        }
-
-        std::vector<int> x_boundaries;
-        for (auto x : x_to_check) {
-            double maximum_value = Q3(x, lat, d.lon, d.lat, current_range);
-            auto minimum_values = min_Q1_Q2(current_positional_data, overlapping_radars, x, lat);
-
-            for (auto min : minimum_values) {
-                maximum_value = std::max(maximum_value, min);
-            }
-
-            // if it equals zero, then yes that IS the boundary
-            if (abs(maximum_value) < EPSILON) {
-                // convert this to roi relative... ugh
-                double bound = width * (x - boundaries[1]) / (boundaries[3] - boundaries[1]) - roi_x_start;
-                x_boundaries.push_back(static_cast<int>(floor(bound)));
-            }
-        }
-
-        std::sort(x_boundaries.begin(), x_boundaries.end());
-        // x_boundaries will ALWAYS have an even length, FYI
-        for (int i = 0; i < x_boundaries.size(); i += 2) {
-            int bound = x_boundaries.at(i);
-            int boundp = x_boundaries.at(i + 1);
-            int lower_bound = std::max(0, bound);
-            int upper_bound = std::min(roi_width, boundp);
+        int row_end = ownership->row_offsets.at(container_y + 1);
+        for (int span = ownership->row_offsets.at(container_y); span < row_end; span += 2) {
+            // spans are in container columns, roi relative from here
+            int lower_bound = std::max(0, ownership->spans.at(span) - roi_x_start);
+            int upper_bound = std::min(roi_width, ownership->spans.at(span + 1) - roi_x_start);
 
             if (lower_bound > roi_width || upper_bound < 0) {
                 continue;
             }
 
-            mtx.lock();
+            // a label map never gives a pixel to two radars, so the jobs can't write over each other
+            if (!single_pass_coverage) {
+                mtx.lock();
+            }
             cv::Mat image_roi_current = image_roi(cv::Rect(lower_bound, y, upper_bound - lower_bound, 1));
             cv::Mat container_roi_current = container_roi(cv::Rect(lower_bound, y, upper_bound - lower_bound, 1));
 
             image_roi_current.copyTo(container_roi_current);
-            mtx.unlock();
+            if (!single_pass_coverage) {
+                mtx.unlock();
+            }
             radar_used_atleast_once = true;
         }
     }
 
     if (radar_used_atleast_once) {
         mtx.lock();
-        used_radars.push_back(&(radars[i]));
+        used_radars.push_back(radars.at(i));
         mtx.unlock();
     }
 
     *is_done = true;
 }
 
-cv::Mat radar::Imagery::render(int width, int height) {
-    std::vector<radar::RadarImage> &radars = get_radar_datas();
-    cv::Mat container = cv::Mat::zeros(height, width, CV_8UC4);
+radar::PositionalData radar::Imagery::position_of(int i) {
+    return {geometry.lon.at(i), geometry.lat.at(i), geometry.range.at(i), geometry.priority.at(i), false};
+}
 
-    std::vector<std::thread> jobs;
-    std::vector<std::string> raw_images(radars.size(), std::string());
-    std::mutex mtx;
+// radar i's spans, solved against its neighbours unless an earlier render of the same area already did
+std::shared_ptr<const radar::Ownership> radar::Imagery::solved_ownership(int width, int height, int i) {
+    PositionalData current = position_of(i);
 
-    std::string runtime_error("");
+    // only radars close enough for their circles to touch this one can share a border with it
+    std::vector<PositionalData> neighbours;
+    for (int list_pos : radar_index->within(current.lat, current.lon, current.range + geometry.max_range)) {
+        auto position = radar_positions.find(radar_index->code(list_pos));
+        if (position != radar_positions.end() && position->second != i) {
+            neighbours.push_back(position_of(position->second));
+        }
+    }
+    std::vector<PositionalData> overlapping_radars = rivals_of(current, neighbours);
+
+    // everything the spans depend on, the frame itself doesn't matter
+    std::vector<double> key(boundaries.begin(), boundaries.end());
+    key.insert(key.end(), {static_cast<double>(width), static_cast<double>(height), current.lon, current.lat,
+                              current.range, static_cast<double>(current.priority)});
+    for (auto &pos_data : overlapping_radars) {
+        key.insert(key.end(), {pos_data.lon, pos_data.lat, pos_data.range, static_cast<double>(pos_data.priority),
+                                  static_cast<double>(pos_data.use_Qx2)});
+    }
 
-    for (int i = 0; i < radars.size(); i++) {
-        auto &d = radars.at(i);
-
-        std::thread job([this, &raw_images, &d, i, &mtx, &runtime_error] {
-            mtx.lock();
-            std::string url = d.data.file.back();
-            mtx.unlock();
-            try {
-                std::string content = fetch::get(url);
-                mtx.lock();
-                raw_images.at(i) = content;
-                mtx.unlock();
-            } catch (std::runtime_error &e) {
-                runtime_error = e.what();
-            }
-        });
+    OwnershipCache &ownership_cache = OwnershipCache::global();
+    std::shared_ptr<const Ownership> ownership = ownership_cache.get(key);
+    if (!ownership) {
+        ownership = solve_ownership(boundaries, width, height, current, overlapping_radars);
+        ownership_cache.put(key, ownership);
+    }
+
+    return ownership;
+}
 
-        jobs.push_back(std::move(job));
+// every radar's spans out of one label map of the whole render, before any job starts
+void radar::Imagery::label_ownership(int width, int height) {
+    std::vector<PositionalData> positions;
+    for (int i = 0; i < geometry.lon.size(); i++) {
+        positions.push_back(position_of(i));
     }
 
-    for (auto &job : jobs) {
-        if (job.joinable()) {
-            job.join();
+    // same as solved_ownership's, only with every radar in it and then which one it's for
+    std::vector<double> key(boundaries.begin(), boundaries.end());
+    key.insert(key.end(), {static_cast<double>(width), static_cast<double>(height), -1.0});
+    for (auto &pos_data : positions) {
+        key.insert(key.end(), {pos_data.lon, pos_data.lat, pos_data.range, static_cast<double>(pos_data.priority)});
+    }
+
+    OwnershipCache &ownership_cache = OwnershipCache::global();
+    coverage.clear();
+    bool cached = true;
+    for (int i = 0; i < positions.size() && cached; i++) {
+        key.push_back(i);
+        coverage.push_back(ownership_cache.get(key));
+        key.pop_back();
+        cached = coverage.back() != nullptr;
+    }
+    if (cached) {
+        return;
+    }
+
+    std::vector<int> labels = label_coverage(boundaries, width, height, positions);
+    coverage = ownership_of_labels(labels, width, height, positions.size());
+    for (int i = 0; i < positions.size(); i++) {
+        key.push_back(i);
+        ownership_cache.put(key, coverage.at(i));
+        key.pop_back();
+    }
+}
+
+cv::Mat radar::Imagery::render(int width, int height) {
+    fetch_deadline = deadline;
+    if (latency_budget.count() > 0) {
+        // deadline being cancelled or running out first still aborts everything
+        fetch_deadline = std::make_shared<fetch::Deadline>(latency_budget, deadline);
+    }
+
+    std::vector<std::shared_ptr<const RadarImage>> &radars = get_radar_datas();
+    cv::Mat container = cv::Mat::zeros(height, width, CV_8UC4);
+
+    std::vector<cv::Mat> frames;
+    std::vector<bool> arrived;
+    std::mutex mtx;
+
+    std::string runtime_error = load_frames(radars, frames, arrived);
+    // no point if the render fails anyway
+    if (runtime_error == "" || latency_budget.count() > 0) {
+        std::string reinstate_error = reinstate_covered(radars, frames, arrived);
+        if (runtime_error == "") {
+            runtime_error = reinstate_error;
         }
     }
 
-    if (runtime_error != "") {
+    if (runtime_error != "" && latency_budget.count() == 0) {
         throw std::runtime_error(runtime_error);
     }
 
+    // partial composite, out of whatever made it in time
+    for (int i = radars.size() - 1; i >= 0; i--) {
+        if (!arrived.at(i)) {
+            radars.erase(radars.begin() + i);
+            frames.erase(frames.begin() + i);
+        }
+    }
+
     used_radars.clear();
 
+    radar_positions.clear();
+    for (int i = 0; i < radars.size(); i++) {
+        radar_positions[radars.at(i)->kode] = i;
+    }
+    build_geometry(radars);
+    if (single_pass_coverage) {
+        label_ownership(width, height);
+    }
+
     struct JobData {
         std::thread job;
         bool done;
@@ -385,14 +355,14 @@ cv::Mat radar::Imagery::render(int width, int height) {
 
     std::vector<JobData *> imgproc_jobs;
 
-    for (int i = 0; i < raw_images.size(); i++) {
+    for (int i = 0; i < frames.size(); i++) {
         JobData *current_job = new JobData;
 
         current_job->done = false;
         bool *is_done = &(current_job->done);
 
-        std::thread job([this, width, height, &radars, &raw_images, &container, i, &mtx, is_done] {
-            this->render_loop(width, height, radars, raw_images, container, i, mtx, is_done);
+        std::thread job([this, width, height, &radars, &frames, &container, i, &mtx, is_done] {
+            this->render_loop(width, height, radars, frames, container, i, mtx, is_done);
         });
 
         current_job->job = std::move(job);
@@ -438,8 +408,8 @@ cv::Mat radar::Imagery::render(int width, int height) {
             uchar &green = pixelValue[1];
             uchar &red = pixelValue[2];
 
-            for (int i = 0; i < radars.at(0).colors.size(); i++) {
-                auto c = radars.at(0).colors.at(i);
+            for (int i = 0; i < radars.at(0)->colors.size(); i++) {
+                auto c = radars.at(0)->colors.at(i);
                 if (red == c.r && green == c.g && blue == c.b) {
                     if (radar::ColorScheme.size() <= i)
                         break;
@@ -455,186 +425,351 @@ cv::Mat radar::Imagery::render(int width, int height) {
     return container;
 }
 
-std::vector<radar::RadarImage> &radar::Imagery::get_radar_datas() {
-    if (radar_datas.size() != 0) {
-        return radar_datas;
+// on up to max_threads threads at once, empty for anything that isn't an image
+static std::vector<cv::Mat> decode_frames(const std::vector<fetch::Buffer> &contents, int max_threads) {
+    std::vector<cv::Mat> images(contents.size());
+    for (int first = 0; first < contents.size(); first += max_threads) {
+        std::vector<std::future<cv::Mat>> decodes;
+        for (int i = first; i < contents.size() && i < first + max_threads; i++) {
+            decodes.push_back(std::async(std::launch::async, radar::decode_frame, std::cref(contents.at(i))));
+        }
+        for (int i = 0; i < decodes.size(); i++) {
+            images.at(first + i) = decodes.at(i).get();
+        }
     }
 
-    std::string content = fetch::get(RADAR_LIST_API_URL);
+    return images;
+}
 
-    std::vector<radar::RadarList> list;
+// decoded, from the frame cache, the store or BMKG, whichever has them first. only frames that
+// decode are kept anywhere. arrived says which ones made it, the first failure is returned
+std::string radar::Imagery::load_frames(const std::vector<std::shared_ptr<const RadarImage>> &radars,
+    std::vector<cv::Mat> &frames, std::vector<bool> &arrived) {
+    frames.assign(radars.size(), cv::Mat());
+    arrived.assign(radars.size(), false);
 
-    json list_data;
-    try {
-        list_data = json::parse(content);
-    } catch (const json::parse_error &e) {
-        std::string err(e.what());
-        throw std::runtime_error("Error parsing JSON: " + err);
-    }
+    CircuitBreaker &breaker = CircuitBreaker::global();
+    FrameCache &frame_cache = FrameCache::global();
+    FrameStore &store = FrameStore::global();
 
-    for (auto &radar : list_data["datas"]) {
-        auto tlc_raw = radar["overlayTLC"];
-        auto brc_raw = radar["overlayBRC"];
+    // already decoded, by the prefetcher or an earlier render
+    std::vector<int> stored;
+    std::vector<fetch::Buffer> stored_contents;
+    for (int i = 0; i < radars.size(); i++) {
+        const RadarImage &d = *radars.at(i);
 
-        double north = std::stod(static_cast<std::string>(tlc_raw[0]));
-        double west = std::stod(static_cast<std::string>(tlc_raw[1]));
-        double south = std::stod(static_cast<std::string>(brc_raw[0]));
-        double east = std::stod(static_cast<std::string>(brc_raw[1]));
+        frames.at(i) = frame_cache.get(d.kode, d.data.time.back());
+        if (!frames.at(i).empty()) {
+            arrived.at(i) = true;
+            continue;
+        }
 
-        std::string kota = static_cast<std::string>(radar["Kota"]);
-        std::string stasiun = static_cast<std::string>(radar["Stasiun"]);
-        std::string kode = static_cast<std::string>(radar["kode"]);
-        double lat = radar["lat"];
-        double lon = radar["lon"];
+        // downloaded before, maybe by the run before this one
+        fetch::Buffer content;
+        if (store.read_frame(d.kode, d.data.time.back(), content)) {
+            stored.push_back(i);
+            stored_contents.push_back(content);
+        }
+    }
 
-        radar::RadarList radar_data;
-        radar_data.boundaries = {north, west, south, east};
-        radar_data.kota = kota;
-        radar_data.stasiun = stasiun;
-        radar_data.kode = kode;
-        radar_data.lat = lat;
-        radar_data.lon = lon;
+    std::vector<cv::Mat> stored_images = decode_frames(stored_contents, max_concurrent_threads);
+    for (int j = 0; j < stored.size(); j++) {
+        const RadarImage &d = *radars.at(stored.at(j));
+        if (stored_images.at(j).empty()) {
+            // as good as not being there, BMKG has it again
+            store.remove_frame(d.kode, d.data.time.back());
+            continue;
+        }
 
-        list.push_back(radar_data);
+        frames.at(stored.at(j)) = stored_images.at(j);
+        arrived.at(stored.at(j)) = true;
+        // the next render of this frame, here or anywhere else, skips the decode
+        frame_cache.put(d.kode, d.data.time.back(), stored_images.at(j));
     }
 
-    std::string runtime_error("");
-    std::vector<std::thread> jobs;
-    std::mutex mtx;
-
-    int count = 0;
-    for (auto &radar : list) {
-        // excluded radar
-        if (std::find(exclude_radar.begin(), exclude_radar.end(), radar.kode) != exclude_radar.end())
+    // radar index of every url
+    std::vector<int> fetched;
+    std::vector<std::string> urls;
+    for (int i = 0; i < radars.size(); i++) {
+        const RadarImage &d = *radars.at(i);
+        if (arrived.at(i))
             continue;
 
-        bool in_range = radar::is_overlapping(boundaries, radar.boundaries);
-        if (!in_range)
+        // the detail came through, but the image host may have gone down since
+        if (!breaker.allow("host:" + fetch::host_of(d.data.file.back()))) {
+            skipped_radars.push_back(d.kode);
             continue;
+        }
 
-        std::string code = radar.kode;
-
-        std::thread job(
-            [this, code, &mtx, &runtime_error, count] { this->fetch_detailed_data(code, mtx, runtime_error, count); });
-        jobs.push_back(std::move(job));
+        fetched.push_back(i);
+        urls.push_back(d.data.file.back());
+    }
 
-        count++;
+    fetch::Options options;
+    options.deadline = fetch_deadline;
+    // one slow radar holds up the whole composite, don't wait on it longer than usual
+    options.hedge = true;
+    options.retries = 2;
+    // a 404 page would end up in the store and the frame cache
+    options.fail_on_error = true;
+    options.site = "radar_image";
+
+    auto downloads = fetch::get_many(urls, options);
+    std::vector<fetch::Buffer> contents(downloads.size());
+    std::vector<std::string> errors(downloads.size());
+    for (int j = 0; j < downloads.size(); j++) {
+        try {
+            contents.at(j) = downloads.at(j).get();
+        } catch (std::runtime_error &e) {
+            errors.at(j) = e.what();
+        }
     }
 
-    for (auto &job : jobs) {
-        if (job.joinable()) {
-            job.join();
+    std::vector<cv::Mat> images = decode_frames(contents, max_concurrent_threads);
+    std::map<std::string, bool> host_answered;
+    std::string runtime_error("");
+
+    for (int j = 0; j < downloads.size(); j++) {
+        int i = fetched.at(j);
+        const RadarImage &d = *radars.at(i);
+
+        if (errors.at(j) == "" && images.at(j).empty()) {
+            errors.at(j) = "Not an image (" + urls.at(j) + ")";
+        }
+
+        if (errors.at(j) == "") {
+            frames.at(i) = images.at(j);
+            arrived.at(i) = true;
+            store.write_frame(d.kode, d.data.time.back(), contents.at(j));
+            frame_cache.put(d.kode, d.data.time.back(), images.at(j));
+            breaker.record_success("radar:" + d.kode);
+            host_answered[fetch::host_of(urls.at(j))] = true;
+        } else {
+            record_failure(d.kode);
+            host_answered.emplace(fetch::host_of(urls.at(j)), false);
+            std::string err = "Failed to fetch radar image of " + d.kode + ": " + errors.at(j);
+            fetch_errors[d.kode] = err;
+            missing_radars.push_back(d.kode);
+            if (runtime_error == "") {
+                runtime_error = err;
+            }
         }
     }
-    return radar_datas;
+
+    record_hosts(host_answered);
+
+    return runtime_error;
 }
 
-radar::Color radar::parseHexColor(const std::string &hexColor) {
-    radar::Color color;
-    if (hexColor[0] == '#') {
-        unsigned int rgb;
-        std::stringstream ss;
-        ss << std::hex << hexColor.substr(1);
-        ss >> rgb;
+// cull_radars left out radars another one covers, which only holds if that one made it in. the
+// ones whose cover is missing go back in, at the end of radars
+std::string radar::Imagery::reinstate_covered(std::vector<std::shared_ptr<const RadarImage>> &radars,
+    std::vector<cv::Mat> &frames, std::vector<bool> &arrived) {
+    std::set<std::string> present;
+    for (int i = 0; i < radars.size(); i++) {
+        if (arrived.at(i)) {
+            present.insert(radars.at(i)->kode);
+        }
+    }
 
-        color.r = (rgb >> 16) & 0xFF;
-        color.g = (rgb >> 8) & 0xFF;
-        color.b = rgb & 0xFF;
+    std::vector<std::shared_ptr<const RadarImage>> reinstated;
+    for (int i = covered_radars.size() - 1; i >= 0; i--) {
+        const std::string &code = covered_radars.at(i)->kode;
+        if (present.count(covered_by.at(code)) == 0) {
+            reinstated.insert(reinstated.begin(), covered_radars.at(i));
+            culled_radars.erase(std::find(culled_radars.begin(), culled_radars.end(), code));
+            covered_by.erase(code);
+            covered_radars.erase(covered_radars.begin() + i);
+        }
     }
-    return color;
-}
 
-void radar::Imagery::fetch_detailed_data(std::string code, std::mutex &mtx, std::string &runtime_error, int index) {
-    char *token_get = std::getenv("token");
-    std::string token = std::string(token_get == NULL ? "" : token_get);
+    if (reinstated.empty())
+        return "";
 
-    std::string URL = token == "" ? radar::RADAR_IMAGE_PUBLIC_API_URL : radar::RADAR_IMAGE_API_URL;
-    URL += "?radar=" + curlpp::escape(code);
+    std::vector<cv::Mat> reinstated_frames;
+    std::vector<bool> reinstated_arrived;
+    std::string runtime_error = load_frames(reinstated, reinstated_frames, reinstated_arrived);
 
-    if (token != "") {
-        URL += "&token=" + curlpp::escape(token);
-    }
+    radars.insert(radars.end(), reinstated.begin(), reinstated.end());
+    frames.insert(frames.end(), reinstated_frames.begin(), reinstated_frames.end());
+    arrived.insert(arrived.end(), reinstated_arrived.begin(), reinstated_arrived.end());
 
-    std::string content;
+    return runtime_error;
+}
 
-    try {
-        content = fetch::get(URL);
-    } catch (std::runtime_error &e) {
-        runtime_error = e.what();
-        return;
+std::vector<std::shared_ptr<const radar::RadarImage>> &radar::Imagery::get_radar_datas() {
+    if (radar_datas.size() != 0) {
+        return radar_datas;
     }
 
-    json parsed_data;
-    try {
-        parsed_data = json::parse(content);
-    } catch (const json::parse_error &e) {
-        std::string err(e.what());
-        runtime_error = ("Error parsing JSON: " + err);
-        return;
+    std::shared_ptr<const RadarCatalog::Snapshot> catalog = RadarCatalog::global().snapshot(fetch_deadline);
+    CircuitBreaker &breaker = CircuitBreaker::global();
+
+    radar_index = catalog->index;
+
+    for (int list_pos : radar_index->overlapping(boundaries)) {
+        const RadarList &radar = catalog->list.at(list_pos);
+
+        // excluded radar
+        if (std::find(exclude_radar.begin(), exclude_radar.end(), radar.kode) != exclude_radar.end())
+            continue;
+
+        // down lately, don't make this render wait on it too
+        if (!breaker.allow("radar:" + radar.kode)) {
+            skipped_radars.push_back(radar.kode);
+            continue;
+        }
+
+        auto detail_pos = catalog->details.find(radar.kode);
+        if (detail_pos == catalog->details.end()) {
+            auto error_pos = catalog->errors.find(radar.kode);
+            if (error_pos != catalog->errors.end()) {
+                fetch_errors[radar.kode] = error_pos->second;
+                missing_radars.push_back(radar.kode);
+            }
+            continue;
+        }
+
+        // ignore if the data is old, if the user specifies so
+        const RadarImage &radar_data = *detail_pos->second;
+        auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(radar_data.data.time.back());
+        if (seconds_to_now > (declare_old_after_mins * 60) && ignore_old_radars)
+            continue;
+
+        radar_datas.push_back(detail_pos->second);
     }
 
-    if (parsed_data.is_null()) {
-        std::string URL = token == "" ? radar::RADAR_IMAGE_PUBLIC_API_URL : radar::RADAR_IMAGE_API_URL;
-        throw std::runtime_error("API " + URL + " returned NULL");
+    cull_radars();
+    return radar_datas;
+}
+
+void radar::Imagery::build_geometry(const std::vector<std::shared_ptr<const RadarImage>> &radars) {
+    geometry = Geometry();
+    geometry.max_range = DEFAULT_RANGE;
+
+    for (auto &radar : radars) {
+        auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(radar->data.time.back());
+
+        geometry.lon.push_back(radar->lon);
+        geometry.lat.push_back(radar->lat);
+        geometry.range.push_back(range_of(*radar));
+        geometry.priority.push_back(priority_of(*radar));
+        geometry.stale.push_back(seconds_to_now > (declare_old_after_mins * 60));
     }
 
-    radar::RadarImage radar_data;
-    if (parsed_data["Latest"]["timeUTC"] == "No Data") {
-        return;
+    // a neighbour can be anywhere within this plus the radar's own range
+    for (auto &range_pos : radarRangeOverride) {
+        geometry.max_range = std::max(geometry.max_range, range_pos.second);
     }
+}
+
+// how far and how important a radar is, old ones having the lowest priority
+double radar::Imagery::range_of(const RadarImage &radar) {
+    auto range_pos = radarRangeOverride.find(radar.kode);
+    return range_pos != radarRangeOverride.end() ? range_pos->second : DEFAULT_RANGE;
+}
+
+int radar::Imagery::priority_of(const RadarImage &radar) {
+    auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(radar.data.time.back());
+    if (seconds_to_now > (declare_old_after_mins * 60))
+        return -1;
 
-    auto tlc_raw = parsed_data["bounds"]["overlayTLC"];
-    auto brc_raw = parsed_data["bounds"]["overlayBRC"];
+    auto priority_pos = radarPriority.find(radar.kode);
+    return priority_pos != radarPriority.end() ? priority_pos->second : 0;
+}
+
+// the image bounds are a square around the range, usually a lot bigger than it. leaves out
+// every radar whose circle misses the map, and every radar whose part of the map is all
+// inside the circle of a radar with a higher priority, which render_loop would draw instead
+void radar::Imagery::cull_radars() {
+    build_geometry(radar_datas);
+    std::vector<double> &ranges = geometry.range;
+    std::vector<int> &priorities = geometry.priority;
+
+    auto distance = [](double lat1, double lon1, double lat2, double lon2) {
+        double dist_x = lon2 - lon1;
+        double dist_y = lat2 - lat1;
+        return sqrt(dist_x * dist_x + dist_y * dist_y);
+    };
+
+    std::vector<bool> culled(radar_datas.size(), false);
+    for (int i = 0; i < radar_datas.size(); i++) {
+        const RadarImage &d = *radar_datas.at(i);
+
+        // the point of the map closest to the radar
+        double nearest_lat = std::max(boundaries[2], std::min(boundaries[0], d.lat));
+        double nearest_lon = std::max(boundaries[1], std::min(boundaries[3], d.lon));
+        if (distance(d.lat, d.lon, nearest_lat, nearest_lon) >= ranges.at(i)) {
+            culled.at(i) = true;
+            continue;
+        }
 
-    double north = std::stod(static_cast<std::string>(tlc_raw[0]));
-    double west = std::stod(static_cast<std::string>(tlc_raw[1]));
-    double south = std::stod(static_cast<std::string>(brc_raw[0]));
-    double east = std::stod(static_cast<std::string>(brc_raw[1]));
+        for (int j = 0; j < radar_datas.size() && !culled.at(i); j++) {
+            if (priorities.at(j) <= priorities.at(i))
+                continue;
 
-    radar_data.boundaries = {north, west, south, east};
-    radar_data.kode = parsed_data["bounds"]["kode"];
-    radar_data.kota = parsed_data["bounds"]["Kota"];
-    radar_data.stasiun = parsed_data["bounds"]["Stasiun"];
-    radar_data.lat = parsed_data["bounds"]["lat"];
-    radar_data.lon = parsed_data["bounds"]["lon"];
+            // a higher priority radar that isn't drawn either got culled by an even higher one
+            // covering the same, so it still holds
+            const RadarImage &over = *radar_datas.at(j);
+            bool covers_circle = distance(d.lat, d.lon, over.lat, over.lon) + ranges.at(i) <= ranges.at(j);
 
-    auto last_1h = parsed_data["LastOneHour"];
-    std::vector<std::chrono::system_clock::time_point> time;
-    std::vector<std::string> file;
+            // a circle is convex, having all four corners means having the whole map
+            bool covers_map = true;
+            for (double lat : {boundaries[0], boundaries[2]}) {
+                for (double lon : {boundaries[1], boundaries[3]}) {
+                    covers_map = covers_map && distance(lat, lon, over.lat, over.lon) <= ranges.at(j);
+                }
+            }
 
-    for (auto &color : parsed_data["legends"]["colors"]) {
-        radar_data.colors.push_back(parseHexColor(color));
+            culled.at(i) = covers_circle || covers_map;
+            if (culled.at(i)) {
+                covered_by[d.kode] = over.kode;
+            }
+        }
     }
 
-    for (int i = 0; i < last_1h["file"].size(); i++) {
-        std::istringstream in{static_cast<std::string>(last_1h["timeUTC"][i])};
-        std::chrono::system_clock::time_point tp;
-        in >> date::parse("%Y-%m-%d %H:%M %Z", tp);
-        std::string filename = last_1h["file"][i];
+    for (int i = radar_datas.size() - 1; i >= 0; i--) {
+        if (culled.at(i)) {
+            culled_radars.push_back(radar_datas.at(i)->kode);
+            if (covered_by.count(radar_datas.at(i)->kode) != 0) {
+                covered_radars.push_back(radar_datas.at(i));
+            }
+            radar_datas.erase(radar_datas.begin() + i);
+        }
+    }
+    std::reverse(culled_radars.begin(), culled_radars.end());
+    std::reverse(covered_radars.begin(), covered_radars.end());
+}
 
-        // debug only
-        // if (radar_data.kode == "PWK") {
-        //     filename = "https://fs.neutrixs.my.id/bmkg_test/PWK.png";
-        // }
-        // if (radar_data.kode == "CGK") {
-        //     filename = "https://fs.neutrixs.my.id/bmkg_test/CGK.png";
-        // }
-        // if (radar_data.kode == "JAK") {
-        //     filename = "https://fs.neutrixs.my.id/bmkg_test/JAK.png";
-        // }
+radar::Color radar::parseHexColor(const std::string &hexColor) {
+    radar::Color color;
+    if (hexColor[0] == '#') {
+        unsigned long rgb = std::strtoul(hexColor.c_str() + 1, nullptr, 16);
 
-        time.push_back(tp);
-        file.push_back(filename);
+        color.r = (rgb >> 16) & 0xFF;
+        color.g = (rgb >> 8) & 0xFF;
+        color.b = rgb & 0xFF;
     }
+    return color;
+}
 
-    // ignore if the data is old, if the user specifies so
-    auto seconds_to_now = std::time(nullptr) - std::chrono::system_clock::to_time_t(time.back());
-    if (seconds_to_now > (declare_old_after_mins * 60) && ignore_old_radars)
+void radar::Imagery::record_failure(const std::string &code) {
+    // running out of this render's own time isn't the radar's fault
+    if (fetch_deadline && fetch_deadline->expired())
         return;
 
-    radar_data.data.file = file;
-    radar_data.data.time = time;
-    mtx.lock();
-    radar_datas.push_back(radar_data);
-    mtx.unlock();
-}
\ No newline at end of file
+    CircuitBreaker::global().record_failure("radar:" + code);
+}
+
+// once per batch, a host that's down fails every radar on it at once and that's still one failure
+void radar::Imagery::record_hosts(const std::map<std::string, bool> &host_answered) {
+    CircuitBreaker &breaker = CircuitBreaker::global();
+    for (auto &host_pos : host_answered) {
+        if (host_pos.second) {
+            breaker.record_success("host:" + host_pos.first);
+        } else if (!fetch_deadline || !fetch_deadline->expired()) {
+            breaker.record_failure("host:" + host_pos.first);
+        }
+    }
+}
+
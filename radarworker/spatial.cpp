@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cmath>
+#include <radarworker/radar.hpp>
+#include <radarworker/spatial.hpp>
+
+radar::RadarIndex::RadarIndex(const std::vector<RadarList> &list, double cell_size) : cell_size(cell_size) {
+    if (list.empty())
+        return;
+
+    double north = -90, west = 180, south = 90, east = -180;
+    for (auto &radar : list) {
+        entries.push_back({radar.kode, radar.lat, radar.lon, radar.boundaries});
+
+        north = std::max({north, radar.boundaries[0], radar.lat});
+        west = std::min({west, radar.boundaries[1], radar.lon});
+        south = std::min({south, radar.boundaries[2], radar.lat});
+        east = std::max({east, radar.boundaries[3], radar.lon});
+    }
+
+    // row 0 is the southernmost
+    origin_lat = south;
+    origin_lon = west;
+    rows = static_cast<int>(std::floor((north - south) / cell_size)) + 1;
+    cols = static_cast<int>(std::floor((east - west) / cell_size)) + 1;
+    bounds_cells.resize(rows * cols);
+    position_cells.resize(rows * cols);
+
+    for (int i = 0; i < entries.size(); i++) {
+        const Entry &entry = entries.at(i);
+        for_cells(entry.bounds[0], entry.bounds[1], entry.bounds[2], entry.bounds[3],
+            [&](int cell) { bounds_cells.at(cell).push_back(i); });
+        position_cells.at(cell_row(entry.lat) * cols + cell_col(entry.lon)).push_back(i);
+    }
+}
+
+int radar::RadarIndex::cell_row(double lat) const {
+    int row = static_cast<int>(std::floor((lat - origin_lat) / cell_size));
+    return std::max(0, std::min(rows - 1, row));
+}
+
+int radar::RadarIndex::cell_col(double lon) const {
+    int col = static_cast<int>(std::floor((lon - origin_lon) / cell_size));
+    return std::max(0, std::min(cols - 1, col));
+}
+
+template <typename F>
+void radar::RadarIndex::for_cells(double north, double west, double south, double east, F visit) const {
+    if (rows == 0 || north < origin_lat || east < origin_lon || south > origin_lat + rows * cell_size ||
+        west > origin_lon + cols * cell_size)
+        return;
+
+    for (int row = cell_row(south); row <= cell_row(north); row++) {
+        for (int col = cell_col(west); col <= cell_col(east); col++) {
+            visit(row * cols + col);
+        }
+    }
+}
+
+std::vector<int> radar::RadarIndex::overlapping(const std::array<double, 4> &bounds) const {
+    std::vector<int> found;
+    for_cells(bounds[0], bounds[1], bounds[2], bounds[3], [&](int cell) {
+        for (int i : bounds_cells.at(cell)) {
+            if (is_overlapping(bounds, entries.at(i).bounds)) {
+                found.push_back(i);
+            }
+        }
+    });
+
+    // a radar spanning several cells turns up once for each of them
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+std::vector<int> radar::RadarIndex::within(double lat, double lon, double distance) const {
+    std::vector<int> found;
+    for_cells(lat + distance, lon - distance, lat - distance, lon + distance, [&](int cell) {
+        for (int i : position_cells.at(cell)) {
+            double dist_x = entries.at(i).lon - lon;
+            double dist_y = entries.at(i).lat - lat;
+            if (sqrt(dist_x * dist_x + dist_y * dist_y) < distance) {
+                found.push_back(i);
+            }
+        }
+    });
+
+    std::sort(found.begin(), found.end());
+    return found;
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <radarworker/store.hpp>
+#include <tuple>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+// radar codes go into paths, keep them to something that can't climb out of the directory
+static std::string station_dir(const std::string &code) {
+    std::string dir = code;
+    for (char &c : dir) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            c = '_';
+        }
+    }
+
+    return dir.empty() ? "_" : dir;
+}
+
+radar::FrameStore &radar::FrameStore::global() {
+    static FrameStore store;
+    return store;
+}
+
+fs::path radar::FrameStore::frame_path(const std::string &code, std::chrono::system_clock::time_point time) {
+    long epoch = std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+    return directory / station_dir(code) / (std::to_string(epoch) + ".png");
+}
+
+// nothing in here throws, the store going bad must not take a render down with it
+bool radar::FrameStore::read(const fs::path &path, fetch::Buffer &data) {
+    boost::system::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (ec || size == 0)
+        return false;
+
+    std::ifstream input_file(path.string(), std::ios::binary);
+    if (!input_file.is_open())
+        return false;
+
+    auto bytes = std::make_shared<std::vector<unsigned char>>(size);
+    input_file.read(reinterpret_cast<char *>(bytes->data()), bytes->size());
+    if (!input_file)
+        return false;
+
+    data = fetch::Buffer(bytes);
+    return true;
+}
+
+// to a temporary file first, so a crash halfway never leaves a truncated one behind
+void radar::FrameStore::write(const fs::path &path, const fetch::Buffer &data) {
+    if (data.size() == 0)
+        return;
+
+    boost::system::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec)
+        return;
+
+    fs::path temporary = path.parent_path() / fs::unique_path("%%%%-%%%%-%%%%.tmp", ec);
+    if (ec)
+        return;
+
+    std::ofstream output_file(temporary.string(), std::ios::binary);
+    output_file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    output_file.close();
+
+    if (!output_file) {
+        fs::remove(temporary, ec);
+        return;
+    }
+
+    fs::rename(temporary, path, ec);
+    if (ec) {
+        fs::remove(temporary, ec);
+    }
+}
+
+bool radar::FrameStore::read_frame(const std::string &code, std::chrono::system_clock::time_point time,
+    fetch::Buffer &data) {
+    return read(frame_path(code, time), data);
+}
+
+void radar::FrameStore::write_frame(const std::string &code, std::chrono::system_clock::time_point time,
+    const fetch::Buffer &data) {
+    write(frame_path(code, time), data);
+}
+
+void radar::FrameStore::remove_frame(const std::string &code, std::chrono::system_clock::time_point time) {
+    boost::system::error_code ec;
+    fs::remove(frame_path(code, time), ec);
+}
+
+bool radar::FrameStore::read_list(fetch::Buffer &data, std::chrono::system_clock::time_point &modified) {
+    fs::path path = directory / "radarlist.json";
+
+    boost::system::error_code ec;
+    std::time_t written = fs::last_write_time(path, ec);
+    if (ec || !read(path, data))
+        return false;
+
+    modified = std::chrono::system_clock::from_time_t(written);
+    return true;
+}
+
+void radar::FrameStore::write_list(const fetch::Buffer &data) {
+    write(directory / "radarlist.json", data);
+}
+
+bool radar::FrameStore::read_detail(const std::string &code, fetch::Buffer &data) {
+    return read(directory / station_dir(code) / "detail.json", data);
+}
+
+void radar::FrameStore::write_detail(const std::string &code, const fetch::Buffer &data) {
+    write(directory / station_dir(code) / "detail.json", data);
+}
+
+void radar::FrameStore::prune_if_due() {
+    mtx.lock();
+    auto now = std::chrono::steady_clock::now();
+    bool due = !pruned || now - last_prune >= prune_interval;
+    if (due) {
+        pruned = true;
+        last_prune = now;
+    }
+    mtx.unlock();
+
+    if (due) {
+        prune();
+    }
+}
+
+void radar::FrameStore::prune() {
+    boost::system::error_code ec;
+    if (!fs::is_directory(directory, ec))
+        return;
+
+    auto now = std::chrono::system_clock::now();
+    std::time_t oldest_allowed = std::chrono::system_clock::to_time_t(now - max_age);
+
+    // frame time, size, path
+    std::vector<std::tuple<long, unsigned long long, fs::path>> frames;
+    unsigned long long total = 0;
+
+    // removed once the walk is over, the iterator fails on an entry that's gone from under it
+    std::vector<fs::path> expired;
+
+    // ec is the walk's own, a file that can't be looked at only skips that file
+    for (fs::recursive_directory_iterator entry(directory, ec), end; !ec && entry != end; entry.increment(ec)) {
+        boost::system::error_code file_ec;
+        fs::path path = entry->path();
+        if (!fs::is_regular_file(path, file_ec))
+            continue;
+
+        std::string name = path.filename().string();
+        std::string extension = path.extension().string();
+
+        // details and leftovers of an interrupted write, by when they were written
+        if (extension != ".png") {
+            std::time_t written = fs::last_write_time(path, file_ec);
+            if (!file_ec && written < oldest_allowed) {
+                expired.push_back(path);
+            }
+            continue;
+        }
+
+        long time = std::atol(name.c_str());
+        if (time < oldest_allowed) {
+            expired.push_back(path);
+            continue;
+        }
+
+        unsigned long long size = fs::file_size(path, file_ec);
+        if (file_ec)
+            continue;
+
+        frames.emplace_back(time, size, path);
+        total += size;
+    }
+
+    for (auto &path : expired) {
+        boost::system::error_code file_ec;
+        fs::remove(path, file_ec);
+    }
+
+    std::sort(frames.begin(), frames.end());
+    for (auto &frame : frames) {
+        if (total <= max_bytes)
+            break;
+
+        boost::system::error_code file_ec;
+        fs::remove(std::get<2>(frame), file_ec);
+        total -= std::get<1>(frame);
+    }
+}
@@ -0,0 +1,253 @@
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <radarworker/transport.hpp>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+std::string fetch::fixture_name(const std::string &url, const Options &options) {
+    std::string key = request_key(url, options);
+
+    size_t token = key.find("token=");
+    if (token != std::string::npos) {
+        size_t end = key.find_first_of("&\n", token);
+        key.erase(token, end == std::string::npos ? std::string::npos : end - token);
+    }
+
+    // FNV-1a, unlike std::hash it's the same on every box the fixtures get copied to
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", hash);
+    return name;
+}
+
+fetch::Recorder::Recorder(std::string directory, std::shared_ptr<Transport> live)
+    : directory(directory), live(std::move(live)) {
+    fs::create_directories(directory);
+    writer = std::thread([this] { this->run(); });
+}
+
+fetch::Recorder::~Recorder() {
+    mtx.lock();
+    stopping = true;
+    mtx.unlock();
+
+    wakeup.notify_all();
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void fetch::Recorder::submit(const std::string &url, const Options &options, Callback on_complete) {
+    std::string name = fixture_name(url, options);
+    live->submit(url, options, [this, name, on_complete](const std::string &url, Buffer body, std::exception_ptr error) {
+        // this is the live transport's I/O thread, the writer does the rest
+        if (!error) {
+            mtx.lock();
+            unsaved.push_back({name, url, body});
+            mtx.unlock();
+            wakeup.notify_all();
+        }
+        on_complete(url, body, error);
+    });
+}
+
+void fetch::Recorder::run() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (true) {
+        wakeup.wait(lock, [this] { return stopping || !unsaved.empty(); });
+        if (unsaved.empty())
+            break;
+
+        Fixture fixture = std::move(unsaved.front());
+        unsaved.pop_front();
+        lock.unlock();
+
+        save(fixture);
+
+        lock.lock();
+    }
+}
+
+// only ever called from the writer, one at a time
+void fetch::Recorder::save(const Fixture &fixture) {
+    std::ofstream output_file(fs::path(directory) / fixture.name, std::ios::binary);
+    output_file.write(reinterpret_cast<const char *>(fixture.body.data()), fixture.body.size());
+    output_file.close();
+
+    // so a human can tell which file is which, the replayer doesn't need it
+    std::ofstream index(fs::path(directory) / "index", std::ios::app);
+    index << fixture.name << " " << fixture.url.substr(0, fixture.url.find("token=")) << "\n";
+}
+
+fetch::Replayer::Replayer(std::string directory, ReplayConfig config)
+    : directory(directory), config(config), rng(std::random_device{}()) {
+    worker = std::thread([this] { this->run(); });
+}
+
+fetch::Replayer::~Replayer() {
+    mtx.lock();
+    stopping = true;
+    mtx.unlock();
+
+    wakeup.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+// called with mtx held. every fixture is read once and kept, so replay latency is only the simulated one
+bool fetch::Replayer::load(const std::string &name, Buffer &body) {
+    auto loaded_pos = loaded.find(name);
+    if (loaded_pos != loaded.end()) {
+        body = loaded_pos->second;
+        return true;
+    }
+
+    fs::path path = fs::path(directory) / name;
+    if (!fs::exists(path))
+        return false;
+
+    auto bytes = std::make_shared<std::vector<unsigned char>>(fs::file_size(path));
+    std::ifstream input_file(path, std::ios::binary);
+    input_file.read(reinterpret_cast<char *>(bytes->data()), bytes->size());
+    if (!input_file)
+        return false;
+
+    body = Buffer(bytes);
+    loaded[name] = body;
+    return true;
+}
+
+void fetch::Replayer::submit(const std::string &url, const Options &options, Callback on_complete) {
+    std::string name = fixture_name(url, options);
+    Response response = {url, options.site, Buffer(), nullptr, options.deadline, std::move(on_complete),
+                         std::chrono::steady_clock::now()};
+
+    mtx.lock();
+    std::uniform_real_distribution<double> chance(0, 1);
+    long latency_ms = config.latency_ms;
+    if (config.latency_jitter_ms > 0) {
+        latency_ms += static_cast<long>(chance(rng) * config.latency_jitter_ms);
+    }
+
+    if (!load(name, response.body)) {
+        response.error = std::make_exception_ptr(std::runtime_error("No recorded response (" + url + ")"));
+    } else if (chance(rng) < config.failure_rate) {
+        response.error = std::make_exception_ptr(std::runtime_error("Simulated failure (" + url + ")"));
+    }
+
+    auto at = response.submitted + std::chrono::milliseconds(latency_ms);
+    if (options.deadline && options.deadline->at < at) {
+        at = options.deadline->at;
+    }
+
+    if (stopping) {
+        mtx.unlock();
+        response.on_complete(url, Buffer(), std::make_exception_ptr(std::runtime_error("HTTP client is shutting down")));
+        return;
+    }
+
+    due.insert({at, std::move(response)});
+    mtx.unlock();
+
+    wakeup.notify_all();
+}
+
+fetch::Stats fetch::Replayer::stats() {
+    mtx.lock();
+    Stats copy = counters;
+    mtx.unlock();
+
+    return copy;
+}
+
+void fetch::Replayer::run() {
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (!stopping) {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<Response> ready;
+
+        for (auto due_pos = due.begin(); due_pos != due.end();) {
+            Response &response = due_pos->second;
+            bool cancelled = response.deadline && response.deadline->expired();
+            if (due_pos->first > now && !cancelled) {
+                due_pos++;
+                continue;
+            }
+
+            if (cancelled) {
+                std::string err = response.deadline->is_cancelled() ? "Transfer cancelled" : "Deadline exceeded";
+                response.body = Buffer();
+                response.error = std::make_exception_ptr(std::runtime_error(err + " (" + response.url + ")"));
+            } else {
+                double total_ms = std::chrono::duration<double, std::milli>(now - response.submitted).count();
+                std::string site = response.site.empty() ? "other" : response.site;
+
+                counters.requests++;
+                counters.latency[host_of(response.url)].record(total_ms);
+                for (Timings *timings : {&counters.timings_by_host[host_of(response.url)], &counters.timings_by_site[site]}) {
+                    timings->total.record(total_ms);
+                    timings->bytes.record(static_cast<double>(response.body.size()));
+                }
+            }
+
+            ready.push_back(std::move(response));
+            due_pos = due.erase(due_pos);
+        }
+
+        lock.unlock();
+        for (auto &response : ready) {
+            response.on_complete(response.url, response.error ? Buffer() : response.body, response.error);
+        }
+        lock.lock();
+
+        // deadlines don't wake us up, same as the live client
+        auto until = now + std::chrono::milliseconds(100);
+        if (!due.empty() && due.begin()->first < until) {
+            until = due.begin()->first;
+        }
+        wakeup.wait_until(lock, until);
+    }
+
+    std::multimap<std::chrono::steady_clock::time_point, Response> leftover;
+    leftover.swap(due);
+    lock.unlock();
+
+    for (auto &leftover_pos : leftover) {
+        Response &response = leftover_pos.second;
+        response.on_complete(response.url, Buffer(), std::make_exception_ptr(std::runtime_error("HTTP client is shutting down")));
+    }
+}
+
+std::shared_ptr<fetch::Transport> fetch::transport_from_env() {
+    std::shared_ptr<Transport> live(&Client::global(), [](Transport *) {});
+
+    char *replay = std::getenv("fetch_replay");
+    if (replay != NULL && std::string(replay) != "") {
+        ReplayConfig config;
+        char *latency = std::getenv("fetch_replay_latency_ms");
+        char *jitter = std::getenv("fetch_replay_jitter_ms");
+        char *failure_rate = std::getenv("fetch_replay_failure_rate");
+
+        config.latency_ms = latency != NULL ? std::atol(latency) : 0;
+        config.latency_jitter_ms = jitter != NULL ? std::atol(jitter) : 0;
+        config.failure_rate = failure_rate != NULL ? std::atof(failure_rate) : 0;
+        return std::make_shared<Replayer>(replay, config);
+    }
+
+    char *record = std::getenv("fetch_record");
+    if (record != NULL && std::string(record) != "") {
+        return std::make_shared<Recorder>(record, live);
+    }
+
+    return live;
+}